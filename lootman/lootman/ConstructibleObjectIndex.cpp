@@ -0,0 +1,192 @@
+#include "ConstructibleObjectIndex.h"
+
+#include <unordered_map>
+
+#include "f4se/GameData.h"
+#include "f4se/GameForms.h"
+#include "f4se/GameObjects.h"
+#include "f4se/GameRTTI.h"
+
+namespace ConstructibleObjectIndex
+{
+    // A COBJ with its components flattened
+    struct Recipe
+    {
+        BGSConstructibleObject * cobj;
+        std::vector<ComponentCount> components;
+    };
+
+    // Only written by Build before the scripts run, so the lookups need no lock
+    std::vector<Recipe> recipes;
+    std::unordered_map<UInt32, UInt32> recipeByCreatedForm;
+    std::vector<BGSComponent *> components;
+    std::unordered_map<BGSComponent *, UInt32> componentIndices;
+    std::unordered_map<UInt32, std::vector<ComponentCount>> miscComponents;
+
+    UInt32 _GetComponentIndex(BGSComponent * component)
+    {
+        auto indexIt = componentIndices.find(component);
+        if(indexIt != componentIndices.end())
+        {
+            return indexIt->second;
+        }
+
+        UInt32 index = (UInt32)components.size();
+        components.push_back(component);
+        componentIndices[component] = index;
+        return index;
+    }
+
+    // Add the count to the component of the list, merging it with the entry already there
+    void _Add(std::vector<ComponentCount> &list, UInt32 index, UInt32 count)
+    {
+        for(ComponentCount &element : list)
+        {
+            if(element.index == index)
+            {
+                element.count += count;
+                return;
+            }
+        }
+
+        ComponentCount element;
+        element.index = index;
+        element.count = count;
+        list.push_back(element);
+    }
+
+    void Build()
+    {
+        recipes.clear();
+        recipeByCreatedForm.clear();
+        components.clear();
+        componentIndices.clear();
+        miscComponents.clear();
+
+        // Number the components in the order of the data, then break every misc object down into them once
+        tArray<BGSComponent *> &componentList = (*g_dataHandler)->arrCMPO;
+        for(UInt32 i = 0; i < componentList.count; i++)
+        {
+            BGSComponent * component = nullptr;
+            componentList.GetNthItem(i, component);
+            if(component)
+            {
+                _GetComponentIndex(component);
+            }
+        }
+
+        tArray<TESObjectMISC *> &miscList = (*g_dataHandler)->arrMISC;
+        for(UInt32 i = 0; i < miscList.count; i++)
+        {
+            TESObjectMISC * misc = nullptr;
+            miscList.GetNthItem(i, misc);
+            if(!misc || !misc->components)
+            {
+                continue;
+            }
+
+            std::vector<ComponentCount> &flattened = miscComponents[misc->formID];
+            for(UInt32 j = 0; j < misc->components->count; j++)
+            {
+                TESObjectMISC::Component miscComponent;
+                misc->components->GetNthItem(j, miscComponent);
+                _Add(flattened, _GetComponentIndex(miscComponent.component), (UInt32)miscComponent.count);
+            }
+        }
+
+        tArray<BGSConstructibleObject *> &cobjList = (*g_dataHandler)->arrCOBJ;
+        for(UInt32 i = 0; i < cobjList.count; i++)
+        {
+            BGSConstructibleObject * cobj = nullptr;
+            cobjList.GetNthItem(i, cobj);
+
+            if(!cobj || !cobj->createdObject || !cobj->components)
+            {
+                continue;
+            }
+
+            Recipe recipe;
+            recipe.cobj = cobj;
+            for(UInt32 j = 0; j < cobj->components->count; j++)
+            {
+                BGSConstructibleObject::Component cobjComponent;
+                cobj->components->GetNthItem(j, cobjComponent);
+
+                TESObjectMISC * misc = DYNAMIC_CAST(cobjComponent.component, TESForm, TESObjectMISC);
+                if(misc)
+                {
+                    // The misc object is scrapped into its components as many times as the recipe needs it
+                    auto miscIt = miscComponents.find(misc->formID);
+                    if(miscIt != miscComponents.end())
+                    {
+                        for(const ComponentCount &element : miscIt->second)
+                        {
+                            _Add(recipe.components, element.index, element.count * cobjComponent.count);
+                        }
+                    }
+                }
+                else
+                {
+                    _Add(recipe.components, _GetComponentIndex(cobjComponent.component), cobjComponent.count);
+                }
+            }
+
+            UInt32 recipeIndex = (UInt32)recipes.size();
+            recipes.push_back(recipe);
+
+            // The first COBJ wins, the same as the linear search this replaces
+            recipeByCreatedForm.insert(std::make_pair(cobj->createdObject->formID, recipeIndex));
+
+            BGSListForm * formList = DYNAMIC_CAST(cobj->createdObject, TESForm, BGSListForm);
+            if(formList)
+            {
+                for(UInt32 j = 0; j < formList->forms.count; j++)
+                {
+                    TESForm * item = nullptr;
+                    formList->forms.GetNthItem(j, item);
+
+                    if(item)
+                    {
+                        recipeByCreatedForm.insert(std::make_pair(item->formID, recipeIndex));
+                    }
+                }
+            }
+        }
+
+        _MESSAGE(">>   Constructible object index is built: [COBJs: %d, Created forms: %d, Components: %d]", cobjList.count, (UInt32)recipeByCreatedForm.size(), (UInt32)components.size());
+    }
+
+    const Recipe * _FindRecipe(UInt32 formId)
+    {
+        auto recipeIt = recipeByCreatedForm.find(formId);
+        return recipeIt != recipeByCreatedForm.end() ? &recipes[recipeIt->second] : nullptr;
+    }
+
+    BGSConstructibleObject * Find(UInt32 formId)
+    {
+        const Recipe * recipe = _FindRecipe(formId);
+        return recipe ? recipe->cobj : nullptr;
+    }
+
+    const std::vector<ComponentCount> * FindComponents(UInt32 formId)
+    {
+        const Recipe * recipe = _FindRecipe(formId);
+        return recipe ? &recipe->components : nullptr;
+    }
+
+    const std::vector<ComponentCount> * FindMiscComponents(UInt32 formId)
+    {
+        auto miscIt = miscComponents.find(formId);
+        return miscIt != miscComponents.end() ? &miscIt->second : nullptr;
+    }
+
+    UInt32 GetComponentCount()
+    {
+        return (UInt32)components.size();
+    }
+
+    BGSComponent * GetComponent(UInt32 index)
+    {
+        return components[index];
+    }
+}
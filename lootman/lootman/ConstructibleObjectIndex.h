@@ -0,0 +1,37 @@
+#pragma once
+
+#include <vector>
+
+#include "common/ITypes.h"
+
+class BGSComponent;
+class BGSConstructibleObject;
+
+// Index of the constructible objects (COBJ) by the form they create, so that finding the recipe of an item or a mod does not walk
+// every COBJ of the game. Form lists created by a COBJ are expanded, so each form of the list maps to the COBJ as well.
+namespace ConstructibleObjectIndex
+{
+    // A component consumed by a recipe. Components are numbered densely, so that the counts can be summed in a flat array
+    struct ComponentCount
+    {
+        UInt32 index;
+        UInt32 count;
+    };
+
+    // Build the index from the loaded COBJs. Called when the game data is ready
+    void Build();
+
+    // Get the first COBJ in load order that creates the form, directly or through a form list. Returns null if there is none
+    BGSConstructibleObject * Find(UInt32 formId);
+
+    // Get the components consumed by the COBJ of Find, with misc objects already broken down into their components. Returns null if there is no COBJ
+    const std::vector<ComponentCount> * FindComponents(UInt32 formId);
+
+    // Get the components a misc object is scrapped into. Returns null if it is not a misc object with components
+    const std::vector<ComponentCount> * FindMiscComponents(UInt32 formId);
+
+    // Number of distinct components, which bounds the indices of ComponentCount
+    UInt32 GetComponentCount();
+
+    BGSComponent * GetComponent(UInt32 index);
+}
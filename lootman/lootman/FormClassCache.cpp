@@ -0,0 +1,119 @@
+#include "FormClassCache.h"
+
+#include <atomic>
+#include <cstring>
+
+#include "f4se/GameForms.h"
+
+#include "FormIDCache.h"
+#include "FormUtil.h"
+#include "InjectionData.h"
+
+namespace FormClassCache
+{
+    // Classifications are stored in pages of a flat table indexed by the form ID: [load order: 8 bits][page: 12 bits][slot: 12 bits].
+    // Pages are allocated when a form in them is first classified, and are never freed so that readers need no lock
+    const UInt32 kPageBits = 12;
+    const UInt32 kPageSize = 1 << kPageBits;
+    const UInt32 kPageCount = 1 << (24 - kPageBits);
+
+    typedef std::atomic<UInt8 *> Page;
+    std::atomic<Page *> directories[256];
+
+    // Get the array in the slot, creating it unless another thread already has
+    template<typename T, typename F>
+    T * _GetOrCreate(std::atomic<T *> &slot, F create)
+    {
+        T * current = slot.load();
+        if(current)
+        {
+            return current;
+        }
+
+        T * created = create();
+        if(!slot.compare_exchange_strong(current, created))
+        {
+            delete [] created;
+            return current;
+        }
+        return created;
+    }
+
+    UInt8 * _GetPage(UInt32 formId)
+    {
+        Page * directory = _GetOrCreate(directories[formId >> 24], []() -> Page *
+        {
+            Page * pages = new Page[kPageCount];
+            for(UInt32 i = 0; i < kPageCount; i++)
+            {
+                pages[i] = nullptr;
+            }
+            return pages;
+        });
+
+        return _GetOrCreate(directory[(formId >> kPageBits) & (kPageCount - 1)], []() -> UInt8 *
+        {
+            UInt8 * page = new UInt8[kPageSize];
+            std::memset(page, 0, kPageSize);
+            return page;
+        });
+    }
+
+    UInt8 _Classify(TESForm * form)
+    {
+        UInt8 formClass = kClass_Known;
+        if(FormUtil::IsPlayable(form))
+        {
+            formClass |= kClass_Playable;
+        }
+        if(FormIDCache::GetIndexedFormTypes().Test(form->formType))
+        {
+            formClass |= kClass_Indexed;
+        }
+        if((form->formID >> 24) == 0xFF)
+        {
+            formClass |= kClass_Created;
+        }
+        if(InjectionData::IsExcludedBaseForm(form))
+        {
+            formClass |= kClass_Excluded;
+        }
+        return formClass;
+    }
+
+    UInt8 Get(TESForm * form)
+    {
+        UInt8 * page = _GetPage(form->formID);
+        UInt8 &slot = page[form->formID & (kPageSize - 1)];
+
+        // Threads classifying the same form at once write the same value, so the race is harmless
+        UInt8 formClass = slot;
+        if(formClass == 0)
+        {
+            formClass = _Classify(form);
+            slot = formClass;
+        }
+        return formClass;
+    }
+
+    void Clear()
+    {
+        for(UInt32 i = 0; i < 256; i++)
+        {
+            Page * directory = directories[i];
+            if(!directory)
+            {
+                continue;
+            }
+
+            for(UInt32 j = 0; j < kPageCount; j++)
+            {
+                UInt8 * page = directory[j];
+                if(page)
+                {
+                    std::memset(page, 0, kPageSize);
+                }
+            }
+        }
+    }
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include "common/ITypes.h"
+
+class TESForm;
+
+// Classification of base forms that does not change while a save is loaded, computed the first time a form is seen.
+// A reference is classified by its base form, so the scans check thousands of references with a few hundred classifications
+namespace FormClassCache
+{
+    enum
+    {
+        kClass_Known    = 1 << 0,   // The form has been classified. A zero byte means it has not
+        kClass_Playable = 1 << 1,   // The form is playable
+        kClass_Indexed  = 1 << 2,   // References of the form are lootable and indexed by FormIDCache
+        kClass_Created  = 1 << 3,   // The form has been created at runtime, which is required for a native object
+        kClass_Excluded = 1 << 4    // The form is excluded by the exclusion lists of the injection data
+    };
+
+    // Get the classification bits of the base form
+    UInt8 Get(TESForm * form);
+
+    // Forget every classification. Form IDs of created forms are reused after loading a save, and the exclusion lists are compiled after the data is loaded
+    void Clear();
+}
@@ -1,10 +1,25 @@
 #include "FormIDCache.h"
 
+#include <algorithm>
+#include <atomic>
+#include <functional>
+
 #include "f4se/GameRTTI.h"
 #include "f4se/GameReferences.h"
 
+#include "FormClassCache.h"
+#include "FormUtil.h"
+#include "InjectionData.h"
+
 EventResult ObjectLoadedListener::ReceiveEvent(TESObjectLoadedEvent * evn, void * dispatcher)
 {
+    if(!evn->loaded)
+    {
+        SimpleLocker locker(&FormIDCache::lock);
+        FormIDCache::Unindex(evn->formId);
+        return kEvent_Continue;
+    }
+
     TESForm * form = LookupFormByID(evn->formId);
     if(!form)
     {
@@ -14,28 +29,42 @@ EventResult ObjectLoadedListener::ReceiveEvent(TESObjectLoadedEvent * evn, void
     TESObjectREFR * ref = DYNAMIC_CAST(form, TESForm, TESObjectREFR);
     if(ref)
     {
-        UInt8 formType = ref->baseForm->formType;
-        if(formType == FormType::kFormType_ACTI ||
-           formType == FormType::kFormType_ALCH ||
-           formType == FormType::kFormType_AMMO ||
-           formType == FormType::kFormType_ARMO ||
-           formType == FormType::kFormType_BOOK ||
-           formType == FormType::kFormType_CONT ||
-           formType == FormType::kFormType_FLOR ||
-           formType == FormType::kFormType_INGR ||
-           formType == FormType::kFormType_KEYM ||
-           formType == FormType::kFormType_MISC ||
-           formType == FormType::kFormType_NPC_ ||
-           formType == FormType::kFormType_WEAP)
+        UInt8 formClass = FormClassCache::Get(ref->baseForm);
+        if((formClass & FormClassCache::kClass_Indexed) != 0)
         {
             TESObjectCELL * cell = ref->parentCell;
             if(cell)
             {
-                SimpleLocker locker(&FormIDCache::lock);
-                if(evn->loaded)
+                SpatialIndex::Entry entry;
+                entry.formId = ref->formID;
+                entry.cellId = cell->formID;
+                entry.cell = cell;
+                entry.formType = ref->baseForm->formType;
+                entry.flags = 0;
+                if((formClass & FormClassCache::kClass_Playable) == 0)
                 {
-                    FormIDCache::cells.insert(cell->formID);
+                    entry.flags |= SpatialIndex::kEntryFlag_NotPlayable;
                 }
+                if(FormUtil::IsNativeObject(ref))
+                {
+                    entry.flags |= SpatialIndex::kEntryFlag_NativeObject;
+                }
+                if((formClass & FormClassCache::kClass_Excluded) != 0 || InjectionData::IsExcludedReference(ref))
+                {
+                    entry.flags |= SpatialIndex::kEntryFlag_Excluded;
+                }
+                // Actors walk away from where they were loaded, and their corpses are looted where they fell
+                if(entry.formType == FormType::kFormType_NPC_)
+                {
+                    entry.flags |= SpatialIndex::kEntryFlag_Movable;
+                }
+                entry.x = ref->pos.x;
+                entry.y = ref->pos.y;
+                entry.z = ref->pos.z;
+                entry.ref = ref;
+
+                SimpleLocker locker(&FormIDCache::lock);
+                FormIDCache::Index(FormIDCache::GetSpaceID(cell), entry);
             }
         }
     }
@@ -48,5 +77,252 @@ namespace FormIDCache
     ObjectLoadedListener eventListener;
 
     SimpleLock lock;
-    std::unordered_set<UInt32> cells;
+    std::unordered_map<UInt32, CellRecord> cells;
+    SpatialIndex::Grid references;
+    UInt32 generation = 0;
+    std::atomic<UInt32> cellGeneration(0);
+
+    UInt32 detachedCells = 0;
+    UInt32 evictedCells = 0;
+
+    // Interval between sweeps in milliseconds
+    const UInt32 kSweepInterval = 1000;
+    // Upper bound of the cells kept. Far more than the cells loaded by uGrids, so it only matters when the sweep falls behind
+    const size_t kMaxCells = 256;
+
+    UInt32 lastSweep = 0;
+
+    FormTypeMask _MakeIndexedFormTypes()
+    {
+        FormTypeMask formTypes;
+        formTypes.Set(FormType::kFormType_ACTI);
+        formTypes.Set(FormType::kFormType_ALCH);
+        formTypes.Set(FormType::kFormType_AMMO);
+        formTypes.Set(FormType::kFormType_ARMO);
+        formTypes.Set(FormType::kFormType_BOOK);
+        formTypes.Set(FormType::kFormType_CONT);
+        formTypes.Set(FormType::kFormType_FLOR);
+        formTypes.Set(FormType::kFormType_INGR);
+        formTypes.Set(FormType::kFormType_KEYM);
+        formTypes.Set(FormType::kFormType_MISC);
+        formTypes.Set(FormType::kFormType_NPC_);
+        formTypes.Set(FormType::kFormType_WEAP);
+        return formTypes;
+    }
+
+    const FormTypeMask indexedFormTypes = _MakeIndexedFormTypes();
+
+    const FormTypeMask & GetIndexedFormTypes()
+    {
+        return indexedFormTypes;
+    }
+
+    struct IndexedRecord
+    {
+        UInt32 generation;
+        UInt32 formId;
+    };
+
+    // Only the recent history is kept. Older generations fall back to a full scan
+    const size_t kMaxIndexedHistory = 4096;
+    std::deque<IndexedRecord> indexedHistory;
+
+    void RecordIndexed(UInt32 formId)
+    {
+        IndexedRecord record;
+        record.generation = ++generation;
+        record.formId = formId;
+        indexedHistory.push_back(record);
+        if(indexedHistory.size() > kMaxIndexedHistory)
+        {
+            indexedHistory.pop_front();
+        }
+    }
+
+    void Index(UInt32 spaceId, const SpatialIndex::Entry &entry)
+    {
+        // Move the reference if it has changed its parent cell
+        UInt32 previousCellId;
+        if(references.GetCellID(entry.formId, previousCellId) && previousCellId != entry.cellId)
+        {
+            Unindex(entry.formId);
+        }
+
+        references.Insert(spaceId, entry);
+        RecordIndexed(entry.formId);
+
+        CellRecord &record = cells[entry.cellId];
+        record.cell = (TESObjectCELL *)entry.cell;
+        record.spaceId = spaceId;
+        record.lastLoaded = GetTickCount();
+        record.refs.insert(entry.formId);
+    }
+
+    void Unindex(UInt32 formId)
+    {
+        UInt32 cellId;
+        if(!references.GetCellID(formId, cellId))
+        {
+            return;
+        }
+
+        references.Remove(formId);
+
+        auto cellIt = cells.find(cellId);
+        if(cellIt == cells.end())
+        {
+            return;
+        }
+
+        cellIt->second.refs.erase(formId);
+        if(cellIt->second.refs.empty())
+        {
+            cells.erase(cellIt);
+            cellGeneration++;
+            detachedCells++;
+        }
+    }
+
+    void _EvictCell(UInt32 cellId)
+    {
+        auto cellIt = cells.find(cellId);
+        if(cellIt == cells.end())
+        {
+            return;
+        }
+
+        for(UInt32 formId : cellIt->second.refs)
+        {
+            references.Remove(formId);
+        }
+        cells.erase(cellIt);
+        cellGeneration++;
+        evictedCells++;
+    }
+
+    void Publish()
+    {
+        references.Publish(cellGeneration);
+    }
+
+    std::shared_ptr<const SpatialIndex::Snapshot> GetSnapshot()
+    {
+        // The loader threads only record their changes, and the first scan after them publishes. A burst of loads is published
+        // once instead of once per reference, and a bucket is copied once per publication however many of its references change
+        if(!references.IsPublished(cellGeneration))
+        {
+            SimpleLocker locker(&lock);
+            Publish();
+        }
+        return references.GetSnapshot();
+    }
+
+    UInt32 GetCellGeneration()
+    {
+        return cellGeneration;
+    }
+
+    void Sweep(UInt32 currentSpaceId)
+    {
+        SimpleLocker locker(&lock);
+
+        UInt32 now = GetTickCount();
+        if(now - lastSweep < kSweepInterval)
+        {
+            return;
+        }
+        lastSweep = now;
+
+        // A cell that is not 3D loaded is kept, because the flag is also clear while the cell is being attached, and its references
+        // would never be loaded again to come back. The scans skip such a cell, and it is detached when its references are unloaded
+        std::vector<UInt32> otherSpaceCellIds;
+        for(auto it = cells.begin(); it != cells.end(); ++it)
+        {
+            if(it->second.spaceId != currentSpaceId)
+            {
+                otherSpaceCellIds.push_back(it->first);
+            }
+        }
+
+        for(UInt32 cellId : otherSpaceCellIds)
+        {
+            _EvictCell(cellId);
+        }
+
+        if(cells.size() > kMaxCells)
+        {
+            // Evict the unloaded cells whose references were loaded the longest time ago. A cell that is still 3D loaded is never evicted,
+            // because its references would stay missing until it is loaded again. Neither is a cell that was loaded during the last
+            // interval, whose flag may only be clear because it is being attached
+            std::vector<std::pair<UInt32, UInt32>> loadedTimes;
+            for(auto it = cells.begin(); it != cells.end(); ++it)
+            {
+                UInt32 age = now - it->second.lastLoaded;
+                if((it->second.cell->flags & 16) == 0 && age >= kSweepInterval)
+                {
+                    loadedTimes.push_back(std::make_pair(age, it->first));
+                }
+            }
+            std::sort(loadedTimes.begin(), loadedTimes.end(), std::greater<std::pair<UInt32, UInt32>>());
+            for(size_t i = 0; i < loadedTimes.size() && cells.size() > kMaxCells; i++)
+            {
+                _EvictCell(loadedTimes[i].second);
+            }
+        }
+
+        Publish();
+
+#ifdef _DEBUG
+        _MESSAGE("| FormIDCache | Live cells: %d, Detached cells: %d, Evicted cells: %d, Indexed references: %d", (UInt32)cells.size(), detachedCells, evictedCells, (UInt32)references.Size());
+#endif
+    }
+
+    UInt32 GetGeneration()
+    {
+        SimpleLocker locker(&lock);
+        return generation;
+    }
+
+    bool GetIndexedSince(UInt32 since, std::vector<UInt32> &formIds, UInt32 &current)
+    {
+        SimpleLocker locker(&lock);
+        current = generation;
+        if(since == generation)
+        {
+            return true;
+        }
+
+        if(indexedHistory.empty() || indexedHistory.front().generation > since + 1)
+        {
+            return false;
+        }
+
+        // Records are in ascending order of generation
+        for(auto it = indexedHistory.rbegin(); it != indexedHistory.rend() && it->generation > since; ++it)
+        {
+            formIds.push_back(it->formId);
+        }
+        return true;
+    }
+
+    UInt32 GetSpaceID(TESObjectCELL * cell)
+    {
+        if((cell->flags & TESObjectCELL::kFlag_IsInterior) != 0 || !cell->worldSpace)
+        {
+            return cell->formID;
+        }
+        // TESWorldSpace is only forward declared by F4SE, but it is a TESForm
+        return ((TESForm *)cell->worldSpace)->formID;
+    }
+
+    void Clear()
+    {
+        SimpleLocker locker(&lock);
+        cells.clear();
+        references.Clear();
+        cellGeneration++;
+        Publish();
+        lastSweep = 0;
+        indexedHistory.clear();
+    }
 }
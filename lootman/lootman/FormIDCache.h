@@ -1,9 +1,17 @@
 #pragma once
 
+#include <deque>
+#include <unordered_map>
 #include <unordered_set>
+#include <vector>
 
 #include "f4se/GameEvents.h"
 
+#include "FormTypeMask.h"
+#include "SpatialIndex.h"
+
+class TESObjectCELL;
+
 class ObjectLoadedListener : public BSTEventSink<TESObjectLoadedEvent>
 {
 public:
@@ -14,6 +22,63 @@ namespace FormIDCache
 {
     extern ObjectLoadedListener eventListener;
 
+    // A cell that has lootable references loaded
+    struct CellRecord
+    {
+        TESObjectCELL * cell;
+        UInt32 spaceId;
+        UInt32 lastLoaded;                  // Tick count of the last reference loaded in the cell
+        std::unordered_set<UInt32> refs;    // References indexed with the cell
+    };
+
+    // Get the form types of the base forms whose references are indexed
+    const FormTypeMask & GetIndexedFormTypes();
+
     extern SimpleLock lock;
-    extern std::unordered_set<UInt32> cells;
+    extern std::unordered_map<UInt32, CellRecord> cells;
+
+    // Number of cells dropped because all their references were unloaded
+    extern UInt32 detachedCells;
+    // Number of cells dropped by the sweep: in another space, or unloaded over the capacity
+    extern UInt32 evictedCells;
+
+    // Lootable references of the loaded cells, indexed by their position. Writers hold the lock and only record their
+    // changes, readers get a snapshot from GetSnapshot and query it without the lock
+    extern SpatialIndex::Grid references;
+
+    // Record that the reference has been indexed. The lock must be held
+    void RecordIndexed(UInt32 formId);
+
+    // Index the reference and attach it to its parent cell. The lock must be held
+    void Index(UInt32 spaceId, const SpatialIndex::Entry &entry);
+
+    // Remove the reference from the index and detach it from its parent cell. The lock must be held
+    void Unindex(UInt32 formId);
+
+    // Get the generation stamp, which advances every time a reference is indexed
+    UInt32 GetGeneration();
+
+    // Get the IDs of the references indexed after the generation, and the current generation. Returns false if the history no longer reaches back that far
+    bool GetIndexedSince(UInt32 since, std::vector<UInt32> &formIds, UInt32 &current);
+
+    // Get the ID of the coordinate system the cell belongs to: the world space ID for exterior cells, or the cell ID for interior cells
+    UInt32 GetSpaceID(TESObjectCELL * cell);
+
+    // Publish the changes of the references to the scans, stamped with the cell generation. The lock must be held
+    void Publish();
+
+    // Get the latest snapshot of the references, publishing the recorded changes first if there are any. Safe to call without the lock,
+    // which is only taken when there is something to publish
+    std::shared_ptr<const SpatialIndex::Snapshot> GetSnapshot();
+
+    // Get the cell generation, which advances every time a cell is detached or the cache is cleared. While it stays the same as
+    // the stamp of a snapshot, the cell pointers of the snapshot's entries are valid. Safe to call without the lock
+    UInt32 GetCellGeneration();
+
+    // Drop the cells that are not in the space of the scanning object, and over the capacity the least recently loaded cells that are no longer
+    // 3D loaded, together with their references. Loaded cells are never dropped. Only runs once per sweep interval, so it is cheap to call for every scan
+    void Sweep(UInt32 currentSpaceId);
+
+    // Clear the cache. Form IDs of created references are reused after loading a save
+    void Clear();
 }
@@ -0,0 +1,88 @@
+#pragma once
+
+#include "common/ITypes.h"
+
+// A set of form types as a 256-bit mask, so that classifying a form is a single bit test
+class FormTypeMask
+{
+public:
+    FormTypeMask()
+    {
+        Clear();
+    }
+
+    void Clear()
+    {
+        for(int i = 0; i < 8; i++)
+        {
+            bits[i] = 0;
+        }
+    }
+
+    void Set(UInt8 formType)
+    {
+        bits[formType >> 5] |= 1U << (formType & 31);
+    }
+
+    // Add every form type of the other mask
+    void Add(const FormTypeMask &other)
+    {
+        for(int i = 0; i < 8; i++)
+        {
+            bits[i] |= other.bits[i];
+        }
+    }
+
+    bool Test(UInt8 formType) const
+    {
+        return (bits[formType >> 5] & (1U << (formType & 31))) != 0;
+    }
+
+    bool IsEmpty() const
+    {
+        for(int i = 0; i < 8; i++)
+        {
+            if(bits[i] != 0)
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Verify that every form type of the other mask is in this mask
+    bool Contains(const FormTypeMask &other) const
+    {
+        for(int i = 0; i < 8; i++)
+        {
+            if((other.bits[i] & ~bits[i]) != 0)
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Call the functor with every form type in the mask, in ascending order
+    template<typename F>
+    void ForEach(F f) const
+    {
+        for(UInt32 i = 0; i < 256; i++)
+        {
+            // Skip the whole word if it is empty
+            if(bits[i >> 5] == 0)
+            {
+                i |= 31;
+                continue;
+            }
+
+            if(Test((UInt8)i))
+            {
+                f((UInt8)i);
+            }
+        }
+    }
+
+private:
+    UInt32 bits[8];
+};
@@ -0,0 +1,129 @@
+#include "FormUtil.h"
+
+#include "f4se/GameExtraData.h"
+#include "f4se/GameForms.h"
+#include "f4se/GameReferences.h"
+#include "f4se/GameRTTI.h"
+
+namespace FormUtil
+{
+    // Get the object instance data of the extra data, which lists the attached mods. Returns null if there is none
+    BGSObjectInstanceExtra::Data * _GetObjectInstanceData(ExtraDataList * extraDataList)
+    {
+        if(!extraDataList)
+        {
+            return nullptr;
+        }
+
+        BSExtraData * extraData = extraDataList->GetByType(ExtraDataType::kExtraData_ObjectInstance);
+        if(!extraData)
+        {
+            return nullptr;
+        }
+
+        BGSObjectInstanceExtra * objectModData = DYNAMIC_CAST(extraData, BSExtraData, BGSObjectInstanceExtra);
+        if(!objectModData)
+        {
+            return nullptr;
+        }
+
+        BGSObjectInstanceExtra::Data * data = objectModData->data;
+        if(!data || !data->forms)
+        {
+            return nullptr;
+        }
+        return data;
+    }
+
+    BGSMod::Attachment::Mod * _GetMod(UInt32 formId)
+    {
+        return (BGSMod::Attachment::Mod *)Runtime_DynamicCast(LookupFormByID(formId), RTTI_TESForm, RTTI_BGSMod__Attachment__Mod);
+    }
+
+    // Call the functor with every mod attached to the extra data until it returns false. Returns false if the functor has stopped the iteration.
+    // Only used inside the plugin, so the mods are read in place instead of being packed into a papyrus array
+    template<typename F>
+    bool _VisitMods(ExtraDataList * extraDataList, F f)
+    {
+        BGSObjectInstanceExtra::Data * data = _GetObjectInstanceData(extraDataList);
+        if(!data)
+        {
+            return true;
+        }
+
+        for(UInt32 i = 0; i < (data->blockSize / sizeof(BGSObjectInstanceExtra::Data::Form)); i++)
+        {
+            BGSMod::Attachment::Mod * objectMod = _GetMod(data->forms[i].formId);
+            if(!objectMod)
+            {
+                continue;
+            }
+
+            if(!f(objectMod))
+            {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    bool IsMod(UInt32 formId)
+    {
+        return _GetMod(formId) != nullptr;
+    }
+
+    bool _IsLegendaryMod(BGSMod::Attachment::Mod * objectMod)
+    {
+        // The 25th bit is the flag for the Legendary item (probably)
+        return objectMod->flags == 25;
+    }
+
+    // Verify that the Legendary is present in the Mod list
+    bool HasLegendaryMod(ExtraDataList * extraDataList)
+    {
+        return !_VisitMods(extraDataList, [](BGSMod::Attachment::Mod * objectMod) -> bool
+        {
+            return !_IsLegendaryMod(objectMod);
+        });
+    }
+
+    void CollectModIDs(ExtraDataList * extraDataList, std::vector<UInt32> &modIds)
+    {
+        BGSObjectInstanceExtra::Data * data = _GetObjectInstanceData(extraDataList);
+        if(!data)
+        {
+            return;
+        }
+
+        for(UInt32 i = 0; i < (data->blockSize / sizeof(BGSObjectInstanceExtra::Data::Form)); i++)
+        {
+            modIds.push_back(data->forms[i].formId);
+        }
+    }
+
+    bool HasLegendaryModID(const UInt32 * modIds, UInt32 count)
+    {
+        for(UInt32 i = 0; i < count; i++)
+        {
+            BGSMod::Attachment::Mod * objectMod = _GetMod(modIds[i]);
+            if(objectMod && _IsLegendaryMod(objectMod))
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Verify that the form is playable
+    bool IsPlayable(TESForm * form)
+    {
+        return form && (form->flags & 1 << 2) == 0;
+    }
+
+    // Verify that an object reference is a native object that cannot be manipulated by papyrus
+    bool IsNativeObject(TESObjectREFR * ref)
+    {
+        return (ref->formID >> 24) == 0xFF && (ref->baseForm->formID >> 24) == 0xFF && (ref->flags & 1 << 14) != 0;
+    }
+}
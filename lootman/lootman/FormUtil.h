@@ -0,0 +1,31 @@
+#pragma once
+
+#include <vector>
+
+#include "common/ITypes.h"
+
+class TESForm;
+class TESObjectREFR;
+class ExtraDataList;
+
+// Checks of forms and of the mods attached to objects, shared by the scans and the caches
+namespace FormUtil
+{
+    // Verify that the form is playable
+    bool IsPlayable(TESForm * form);
+
+    // Verify that an object reference is a native object that cannot be manipulated by papyrus
+    bool IsNativeObject(TESObjectREFR * ref);
+
+    // Verify that the form ID is the one of an object mod
+    bool IsMod(UInt32 formId);
+
+    // Verify that the mods attached to the extra data include a legendary mod
+    bool HasLegendaryMod(ExtraDataList * extraDataList);
+
+    // Append the form IDs of the mods attached to the extra data. No mod is looked up, so it is cheap enough to call under an inventory lock
+    void CollectModIDs(ExtraDataList * extraDataList, std::vector<UInt32> &modIds);
+
+    // Verify that the mods of the form IDs include a legendary mod
+    bool HasLegendaryModID(const UInt32 * modIds, UInt32 count);
+}
@@ -2,9 +2,18 @@
 
 #include <fstream>
 #include <filesystem>
+#include <string>
+#include <unordered_set>
 
 #include "f4se_common/Utilities.h"
 
+#include "f4se/GameData.h"
+#include "f4se/GameExtraData.h"
+#include "f4se/GameFormComponents.h"
+#include "f4se/GameForms.h"
+#include "f4se/GameReferences.h"
+#include "f4se/GameRTTI.h"
+
 #include "lib/rapidjson/istreamwrapper.h"
 
 #include "lib/rapidjson/stringbuffer.h"
@@ -124,4 +133,147 @@ namespace InjectionData
         _MESSAGE(">>   Lootman injection data initialization end.");
         return true;
     }
+
+    // Not defined by F4SE. The location ref type assigned to a persistent reference in the editor. The only member follows the 0x18 bytes
+    // of BSExtraData, and the type is checked through its RTTI before the member is read
+    class ExtraLocationRefType : public BSExtraData
+    {
+    public:
+        BGSLocationRefType * refType;   // 18
+    };
+    STATIC_ASSERT(sizeof(BSExtraData) == 0x18);
+    STATIC_ASSERT(sizeof(ExtraLocationRefType) == 0x20);
+
+    std::unordered_set<UInt32> excludedFormIds;
+    std::unordered_set<UInt32> excludedKeywordIds;
+    std::unordered_set<UInt32> excludedLocationRefTypeIds;
+
+    void GetForms(const char * identify, std::vector<TESForm *> &forms)
+    {
+        auto dataIt = formListData.FindMember(identify);
+        if(dataIt == formListData.MemberEnd() || !dataIt->value.IsArray())
+        {
+            return;
+        }
+
+        for (auto it = dataIt->value.Begin(); it != dataIt->value.End(); ++it)
+        {
+            if(!it->IsString())
+            {
+                continue;
+            }
+
+            std::string value = it->GetString();
+            std::string::size_type delimiter = value.find('|');
+            if(delimiter != std::string::npos)
+            {
+                std::string modName = value.substr(0, delimiter);
+                const ModInfo * info = (*g_dataHandler)->LookupModByName(modName.c_str());
+                if(!info)
+                {
+                    _WARNING("* Mod is not found [%s]", modName.c_str());
+                    continue;
+                }
+
+                std::string lowerFormId = value.substr(delimiter + 1);
+                UInt32 formId = info->GetFormID(std::stoul(lowerFormId, nullptr, 16));
+                TESForm * form = LookupFormByID(formId);
+                if(!form)
+                {
+                    _WARNING("* Form is not found [ModName: %s, LowerFormID: %s, FormID: %08X]", modName.c_str(), lowerFormId.c_str(), formId);
+                    continue;
+                }
+
+                forms.push_back(form);
+            }
+        }
+    }
+
+    void CompileExclusions()
+    {
+        _MESSAGE(">>   Lootman exclusion compilation start.");
+
+        excludedFormIds.clear();
+        excludedKeywordIds.clear();
+        excludedLocationRefTypeIds.clear();
+
+        std::vector<TESForm *> forms;
+        GetForms("ExcludeFormList", forms);
+        for(TESForm * form : forms)
+        {
+            excludedFormIds.insert(form->formID);
+        }
+
+        forms.clear();
+        GetForms("ExcludeKeywordList", forms);
+        for(TESForm * form : forms)
+        {
+            excludedKeywordIds.insert(form->formID);
+        }
+
+        // The list may also hold references, which are excluded by their own form IDs
+        forms.clear();
+        GetForms("ExcludeLocationRefList", forms);
+        for(TESForm * form : forms)
+        {
+            if(form->formType == FormType::kFormType_LCRT)
+            {
+                excludedLocationRefTypeIds.insert(form->formID);
+            }
+            else
+            {
+                excludedFormIds.insert(form->formID);
+            }
+        }
+
+        _MESSAGE(">>     Forms: %d, Keywords: %d, Location ref types: %d", (UInt32)excludedFormIds.size(), (UInt32)excludedKeywordIds.size(), (UInt32)excludedLocationRefTypeIds.size());
+        _MESSAGE(">>   Lootman exclusion compilation end.");
+    }
+
+    bool IsExcludedBaseForm(TESForm * form)
+    {
+        if(excludedFormIds.find(form->formID) != excludedFormIds.end())
+        {
+            return true;
+        }
+
+        if(excludedKeywordIds.empty())
+        {
+            return false;
+        }
+
+        BGSKeywordForm * keywordForm = DYNAMIC_CAST(form, TESForm, BGSKeywordForm);
+        if(!keywordForm)
+        {
+            return false;
+        }
+
+        for(UInt32 i = 0; i < keywordForm->numKeywords; i++)
+        {
+            BGSKeyword * keyword = keywordForm->keywords[i];
+            if(keyword && excludedKeywordIds.find(keyword->formID) != excludedKeywordIds.end())
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool IsExcludedReference(TESObjectREFR * ref)
+    {
+        if(excludedFormIds.find(ref->formID) != excludedFormIds.end())
+        {
+            return true;
+        }
+
+        if(excludedLocationRefTypeIds.empty() || !ref->extraDataList)
+        {
+            return false;
+        }
+
+        // Only the ref type of the reference itself is checked, as ObjectReference.HasLocRefType does in the scripts that applied the list before.
+        // Ref types that a reference would inherit from its encounter zone or location are not markers of the reference, so they do not exclude it
+        ExtraLocationRefType * extra = DYNAMIC_CAST(ref->extraDataList->GetByType(kExtraData_LocationRefType), BSExtraData, ExtraLocationRefType);
+        return extra && extra->refType && excludedLocationRefTypeIds.find(extra->refType->formID) != excludedLocationRefTypeIds.end();
+    }
 }
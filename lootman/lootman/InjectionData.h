@@ -1,11 +1,29 @@
 
+#include <vector>
+
 #include "lib/rapidjson/document.h"
 
 using namespace rapidjson;
 
+class TESForm;
+class TESObjectREFR;
+
 namespace InjectionData
 {
     bool Initialize();
 
     extern Document formListData;
+
+    // Resolve the forms of the list. The values of the list are in the format of "ModName|LowerFormID"
+    void GetForms(const char * identify, std::vector<TESForm *> &forms);
+
+    // Compile the exclusion lists into hash sets for the scans. Called when the game data is ready
+    void CompileExclusions();
+
+    // Verify that the base form is excluded by the form list or has a keyword of the keyword list
+    bool IsExcludedBaseForm(TESForm * form);
+
+    // Verify that the reference itself is excluded by the form list or has a location ref type of the location ref list.
+    // Only the ref type set on the reference counts, not the ones of its encounter zone or location
+    bool IsExcludedReference(TESObjectREFR * ref);
 }
@@ -0,0 +1,297 @@
+#include "InventoryDigestCache.h"
+
+#include <atomic>
+#include <unordered_map>
+
+#include "f4se/GameEvents.h"
+#include "f4se/GameReferences.h"
+#include "f4se/GameRTTI.h"
+
+#include "FormUtil.h"
+#include "Scratch.h"
+
+namespace InventoryDigestCache
+{
+    // Maximum number of inventories watched at once. The least recently used one is dropped beyond it
+    const UInt32 kMaxRecords = 64;
+
+    // Watches an inventory list and keeps the digest of its inventory
+    class Record : public BSTEventSink<BGSInventoryListEvent::Event>
+    {
+    public:
+        virtual EventResult ReceiveEvent(BGSInventoryListEvent::Event * evn, void * dispatcher)
+        {
+            changed = true;
+            return kEvent_Continue;
+        }
+
+        UInt32 refId;
+        BGSInventoryList * inventoryList;
+        UInt32 lastUsed;
+        std::atomic<bool> changed;
+
+        // Shape of the item array when the digest was built. A change of it also invalidates the digest, in case an event has been missed
+        BGSInventoryItem * builtEntries;
+        UInt32 builtCount;
+        std::shared_ptr<const Digest> digest;
+    };
+
+    typedef BSTEventDispatcher<BGSInventoryListEvent::Event> InventoryListDispatcher;
+
+    // Not defined by F4SE. An inventory list begins with the event source of its BGSInventoryListEvent, which has the layout of
+    // BSTEventDispatcher: unk00 of F4SE is the lock, eventSinks at 08 are the sinks, and the items start where the dispatcher ends.
+    // The asserts hold the two declarations of F4SE to each other, so that a change of either breaks the build
+    const UInt32 kInventoryListDispatcherOffset = 0x00;
+
+    STATIC_ASSERT(sizeof(InventoryListDispatcher) == 0x58);
+    STATIC_ASSERT(offsetof(InventoryListDispatcher, eventSinks) == 0x08);
+    STATIC_ASSERT(offsetof(BGSInventoryList, eventSinks) == kInventoryListDispatcherOffset + offsetof(InventoryListDispatcher, eventSinks));
+    STATIC_ASSERT(offsetof(BGSInventoryList, items) == kInventoryListDispatcherOffset + sizeof(InventoryListDispatcher));
+
+    // Guards the records. Never held while an inventory is walked
+    SimpleLock lock;
+    std::unordered_map<UInt32, Record *> records;
+
+    // Records are never freed, because an inventory list that has been destroyed cannot be told to forget them.
+    // Released records are reused, and a stale registration only causes a spurious rebuild
+    std::vector<Record *> freeRecords;
+
+    UInt32 builds = 0;
+    UInt32 hits = 0;
+
+    InventoryListDispatcher * _GetDispatcher(BGSInventoryList * inventoryList)
+    {
+        return (InventoryListDispatcher *)((UInt8 *)inventoryList + kInventoryListDispatcherOffset);
+    }
+
+    bool _IsRegistered(Record * record)
+    {
+        InventoryListDispatcher * dispatcher = _GetDispatcher(record->inventoryList);
+        SimpleLocker locker(&dispatcher->lock);
+        for(UInt32 i = 0; i < dispatcher->eventSinks.count; i++)
+        {
+            if(dispatcher->eventSinks[i] == record)
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Stop watching the inventory list if it still belongs to the reference, and put the record back to the pool
+    void _Release(Record * record)
+    {
+        TESObjectREFR * ref = DYNAMIC_CAST(LookupFormByID(record->refId), TESForm, TESObjectREFR);
+        if(ref && ref->inventoryList == record->inventoryList)
+        {
+            _GetDispatcher(record->inventoryList)->RemoveEventSink(record);
+        }
+
+        record->digest.reset();
+        freeRecords.push_back(record);
+    }
+
+    void _EvictLeastRecentlyUsed()
+    {
+        auto oldestIt = records.end();
+        for(auto it = records.begin(); it != records.end(); ++it)
+        {
+            if(oldestIt == records.end() || it->second->lastUsed - oldestIt->second->lastUsed > 0x80000000)
+            {
+                oldestIt = it;
+            }
+        }
+
+        if(oldestIt != records.end())
+        {
+            _Release(oldestIt->second);
+            records.erase(oldestIt);
+        }
+    }
+
+    // What is copied of an item under the inventory lock. The item is classified from it after the lock is released
+    struct ItemSnapshot
+    {
+        TESForm * form;
+        SInt32 count;
+        UInt16 stackFlags;  // Flags of all the stacks combined
+        UInt32 firstModId;  // Range of the item's mod IDs in the mod ID buffer
+        UInt32 modIdCount;
+    };
+
+    // Buffers of the builds. Kept per thread, as the builds run without the lock of the cache
+    struct BuildScratch
+    {
+        Scratch::Vector<ItemSnapshot> itemSnapshots;
+        Scratch::Vector<UInt32> modIds;
+    };
+
+    __declspec(thread) BuildScratch * buildScratch = nullptr;
+
+    std::shared_ptr<const Digest> _Build(BGSInventoryList * inventoryList)
+    {
+        if(!buildScratch)
+        {
+            buildScratch = new BuildScratch();
+        }
+        Scratch::Vector<ItemSnapshot> &itemSnapshots = buildScratch->itemSnapshots;
+        Scratch::Vector<UInt32> &modIds = buildScratch->modIds;
+        itemSnapshots.Reset();
+        modIds.Reset();
+
+        // The game's writers wait while the lock is held, so only plain values are copied under it
+        {
+            BSReadLocker locker(&inventoryList->inventoryLock);
+
+            for(UInt32 i = 0; i < inventoryList->items.count; i++)
+            {
+                BGSInventoryItem item;
+                inventoryList->items.GetNthItem(i, item);
+                if(!item.form || !item.stack)
+                {
+                    continue;
+                }
+
+                bool isEquipment = item.form->formType == FormType::kFormType_WEAP || item.form->formType == FormType::kFormType_ARMO;
+
+                ItemSnapshot snapshot;
+                snapshot.form = item.form;
+                snapshot.count = 0;
+                snapshot.stackFlags = 0;
+                snapshot.firstModId = (UInt32)modIds.size();
+                item.stack->Visit([&](BGSInventoryItem::Stack * stack) mutable
+                {
+                    snapshot.count += stack->count;
+                    snapshot.stackFlags |= stack->flags;
+                    if(isEquipment)
+                    {
+                        FormUtil::CollectModIDs(stack->extraData, modIds);
+                    }
+                    return true;
+                });
+                snapshot.modIdCount = (UInt32)modIds.size() - snapshot.firstModId;
+
+                itemSnapshots.push_back(snapshot);
+            }
+        }
+
+        std::shared_ptr<Digest> digest = std::make_shared<Digest>();
+        digest->items.reserve(itemSnapshots.size());
+        for(const ItemSnapshot &snapshot : itemSnapshots)
+        {
+            if(!FormUtil::IsPlayable(snapshot.form))
+            {
+                continue;
+            }
+
+            Item entry;
+            entry.form = snapshot.form;
+            entry.count = snapshot.count;
+            entry.flags = 0;
+            if(snapshot.form->formType == FormType::kFormType_WEAP && (snapshot.stackFlags & 1 << 5) != 0)
+            {
+                entry.flags |= kItemFlag_DroppedWeapon;
+            }
+            if(snapshot.modIdCount > 0 && FormUtil::HasLegendaryModID(&modIds[snapshot.firstModId], snapshot.modIdCount))
+            {
+                entry.flags |= kItemFlag_Legendary;
+            }
+
+            digest->items.push_back(entry);
+        }
+
+        return digest;
+    }
+
+    std::shared_ptr<const Digest> Get(TESObjectREFR * ref)
+    {
+        BGSInventoryList * inventoryList = ref->inventoryList;
+        if(!inventoryList)
+        {
+            return nullptr;
+        }
+
+        Record * record = nullptr;
+        {
+            SimpleLocker locker(&lock);
+
+            auto recordIt = records.find(ref->formID);
+            if(recordIt != records.end())
+            {
+                record = recordIt->second;
+
+                // The inventory list is replaced when the reference is reloaded, and the new one knows nothing of the record
+                if(record->inventoryList != inventoryList || !_IsRegistered(record))
+                {
+                    _Release(record);
+                    records.erase(recordIt);
+                    record = nullptr;
+                }
+            }
+
+            if(!record)
+            {
+                if(records.size() >= kMaxRecords)
+                {
+                    _EvictLeastRecentlyUsed();
+                }
+
+                if(freeRecords.empty())
+                {
+                    record = new Record();
+                }
+                else
+                {
+                    record = freeRecords.back();
+                    freeRecords.pop_back();
+                }
+
+                record->refId = ref->formID;
+                record->inventoryList = inventoryList;
+                record->changed = true;
+                _GetDispatcher(inventoryList)->AddEventSink(record);
+                records[ref->formID] = record;
+            }
+
+            record->lastUsed = GetTickCount();
+
+            // The flag is reset before the build, so that a change during the build causes the next call to build again.
+            // The digest is dropped with it, so that a call made during the build builds on its own instead of returning the old one
+            bool reshaped = inventoryList->items.entries != record->builtEntries || inventoryList->items.count != record->builtCount;
+            if(record->changed.exchange(false) || reshaped)
+            {
+                record->builtEntries = inventoryList->items.entries;
+                record->builtCount = inventoryList->items.count;
+                record->digest.reset();
+            }
+
+            if(record->digest)
+            {
+                hits++;
+                return record->digest;
+            }
+        }
+
+        std::shared_ptr<const Digest> digest = _Build(inventoryList);
+
+        // The lock is only taken again to put the digest in the record, which may have been released or reused during the build
+        SimpleLocker locker(&lock);
+        builds++;
+        auto recordIt = records.find(ref->formID);
+        if(recordIt != records.end() && recordIt->second == record && record->inventoryList == inventoryList)
+        {
+            record->digest = digest;
+        }
+        return digest;
+    }
+
+    void Clear()
+    {
+        SimpleLocker locker(&lock);
+        for(auto &element : records)
+        {
+            _Release(element.second);
+        }
+        records.clear();
+    }
+}
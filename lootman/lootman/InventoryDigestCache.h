@@ -0,0 +1,43 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+
+#include "common/ITypes.h"
+
+class TESForm;
+class TESObjectREFR;
+
+// Summaries of the inventories of containers and corpses, so that the loot scans that query the same unchanged container
+// every tick cost a hash lookup instead of locking and walking the inventory. A digest is invalidated by the events of its inventory list
+namespace InventoryDigestCache
+{
+    enum
+    {
+        kItemFlag_DroppedWeapon = 1 << 0,   // A stack of the weapon has been dropped by an actor
+        kItemFlag_Legendary     = 1 << 1    // A stack of the weapon or armor has a legendary mod
+    };
+
+    // A playable item of the inventory, with the counts of its stacks summed
+    struct Item
+    {
+        TESForm * form;
+        SInt32 count;
+        UInt32 flags;   // kItemFlag_*
+    };
+
+    struct Digest
+    {
+        std::vector<Item> items;
+    };
+
+    // Get the digest of the inventory of the object, building it if the inventory has changed since the last call. Returns null if the object has no inventory
+    std::shared_ptr<const Digest> Get(TESObjectREFR * ref);
+
+    // Number of digests built, and number of calls answered by a digest that was already built
+    extern UInt32 builds;
+    extern UInt32 hits;
+
+    // Forget every digest. Form IDs of created references are reused after loading a save
+    void Clear();
+}
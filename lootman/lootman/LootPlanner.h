@@ -0,0 +1,255 @@
+#pragma once
+
+#include <algorithm>
+#include <vector>
+
+#include "FormTypeMask.h"
+#include "Scratch.h"
+
+// The planner behind BuildLootPlan. It decides which sources to loot and which of their items to take or scrap, in the order
+// to execute them, and only sees the world through the functions of the world it is given. BuildLootPlan gives it the game,
+// the tests give it a synthetic world. The world is asked for as little as possible: nothing about a source is read
+// until the plan reaches it, and nothing is read at all once the plan is full.
+//
+// A world has these functions:
+//   bool IsDead(const Source &source)                  The actor is dying or dead
+//   bool IsLinkedToWorkshop(const Source &source)      The container or actor is linked to a workshop
+//   void GetItem(const Source &source, Item &item)     Fill the item an item reference stands for
+//   void GetItems(const Source &source, std::vector<Item> &items)
+//                                                      Append the items in the inventory of a container or actor
+//   void Scrap(const Source &source, std::vector<Item> &items, std::vector<Component> &components)
+//                                                      Append the components of every item with kItemFlag_Scrap
+//                                                      and set the range of the item in them
+namespace LootPlanner
+{
+    // Options of a plan
+    enum
+    {
+        kLootPlan_Containers        = 1 << 0,   // Plan the items in containers
+        kLootPlan_Corpses           = 1 << 1,   // Plan the items of dead actors
+        kLootPlan_ApplyExclusions   = 1 << 2,   // Skip the objects excluded by the injection data
+        kLootPlan_SkipLegendary     = 1 << 3,   // Skip legendary weapons and armors
+        kLootPlan_IncludeWorkshop   = 1 << 4,   // Also plan containers linked to a workshop
+        kLootPlan_ScrapEquipment    = 1 << 5,   // Scrap the weapons and armors that are not legendary
+        kLootPlan_ScrapJunk         = 1 << 6    // Scrap the misc objects
+    };
+
+    // Flags of a planned action
+    enum
+    {
+        kLootAction_PickUp      = 1 << 0,   // The source is the item itself and is picked up
+        kLootAction_FromActor   = 1 << 1,   // The source is an actor
+        kLootAction_Legendary   = 1 << 2,   // The item is a legendary weapon or armor
+        kLootAction_Scrap       = 1 << 3,   // The item is scrapped instead of taken. Its components follow it
+        kLootAction_Component   = 1 << 4    // The item is a component of the scrapped item before it and is given to the player
+    };
+
+    enum SourceKind
+    {
+        kSource_Item,
+        kSource_Container,
+        kSource_Actor
+    };
+
+    // Flags of an item
+    enum
+    {
+        kItemFlag_DroppedWeapon = 1 << 0,   // A stack of the weapon has been dropped by an actor
+        kItemFlag_Legendary     = 1 << 1,   // The weapon or armor has a legendary mod
+        kItemFlag_Excluded      = 1 << 2,   // The base form is excluded by the injection data
+        kItemFlag_Equipment     = 1 << 3,   // A weapon or armor, which is scrapped with its mods
+        kItemFlag_Junk          = 1 << 4,   // A misc object, which is scrapped into its components
+        kItemFlag_Scrap         = 1 << 5    // Set by the planner on the items to scrap
+    };
+
+    // A reference found by the scan
+    struct Source
+    {
+        void * ref;
+        UInt8 kind;     // SourceKind
+        float distance;
+    };
+
+    // An item of a source, with the counts of its stacks summed
+    struct Item
+    {
+        void * form;
+        UInt8 formType;
+        SInt32 count;
+        UInt32 flags;           // kItemFlag_*
+        UInt32 firstComponent;  // Range of the components of scrapping the item, set by the world
+        UInt32 componentCount;
+    };
+
+    // A component of scrapping every object of an item
+    struct Component
+    {
+        void * form;
+        UInt32 count;
+    };
+
+    struct Action
+    {
+        void * source;
+        void * item;
+        UInt32 count;
+        UInt32 flags;   // kLootAction_*
+    };
+
+    // Buffers of the planner. Kept by the caller and reused by the next plan
+    struct Workspace
+    {
+        Scratch::Vector<Item> items;
+        Scratch::Vector<Component> components;
+    };
+
+    // Verify that the item is to be planned
+    inline bool IsSelected(const Item &item, const FormTypeMask &itemTypes, UInt32 options)
+    {
+        if(!itemTypes.Test(item.formType) || item.count <= 0 || (item.flags & kItemFlag_DroppedWeapon) != 0)
+        {
+            return false;
+        }
+
+        if((item.flags & kItemFlag_Legendary) != 0 && (options & kLootPlan_SkipLegendary) != 0)
+        {
+            return false;
+        }
+
+        return (item.flags & kItemFlag_Excluded) == 0 || (options & kLootPlan_ApplyExclusions) == 0;
+    }
+
+    // Verify that the item is to be scrapped. Legendary items are always taken
+    inline bool IsScrapped(const Item &item, UInt32 options)
+    {
+        if((item.flags & kItemFlag_Legendary) != 0)
+        {
+            return false;
+        }
+
+        return ((item.flags & kItemFlag_Equipment) != 0 && (options & kLootPlan_ScrapEquipment) != 0) ||
+               ((item.flags & kItemFlag_Junk) != 0 && (options & kLootPlan_ScrapJunk) != 0);
+    }
+
+    // Plan the loot of the sources into at most maxActions actions, closest source first. The sources are sorted in place.
+    // A scrapped item and its components are planned together or not at all, and the plan ends at the first one that does not fit
+    template<typename World>
+    void Plan(World &world, const void * player, std::vector<Source> &sources, const FormTypeMask &itemTypes, UInt32 options,
+              UInt32 maxActions, Workspace &workspace, std::vector<Action> &actions)
+    {
+        // Closest first, so that the plan can be cut at any point
+        std::stable_sort(sources.begin(), sources.end(), [](const Source &a, const Source &b)
+        {
+            return a.distance < b.distance;
+        });
+
+        Scratch::Vector<Item> &items = workspace.items;
+        Scratch::Vector<Component> &components = workspace.components;
+        for(const Source &source : sources)
+        {
+            if(actions.size() >= maxActions)
+            {
+                return;
+            }
+
+            items.Reset();
+            UInt32 sourceFlags = 0;
+            if(source.kind == kSource_Item)
+            {
+                Item item;
+                world.GetItem(source, item);
+                items.push_back(item);
+                sourceFlags = kLootAction_PickUp;
+            }
+            else
+            {
+                UInt32 option = source.kind == kSource_Actor ? (UInt32)kLootPlan_Corpses : (UInt32)kLootPlan_Containers;
+                if((options & option) == 0 || source.ref == player)
+                {
+                    continue;
+                }
+
+                // Only the dead are looted, whatever papyrus checks on its side
+                if(source.kind == kSource_Actor && !world.IsDead(source))
+                {
+                    continue;
+                }
+
+                if((options & kLootPlan_IncludeWorkshop) == 0 && world.IsLinkedToWorkshop(source))
+                {
+                    continue;
+                }
+
+                world.GetItems(source, items);
+                sourceFlags = source.kind == kSource_Actor ? (UInt32)kLootAction_FromActor : 0;
+            }
+
+            bool hasScrap = false;
+            size_t selected = 0;
+            for(size_t i = 0; i < items.size(); i++)
+            {
+                if(!IsSelected(items[i], itemTypes, options))
+                {
+                    continue;
+                }
+
+                Item &item = items[selected++];
+                item = items[i];
+                item.firstComponent = 0;
+                item.componentCount = 0;
+                if(IsScrapped(item, options))
+                {
+                    item.flags |= kItemFlag_Scrap;
+                    hasScrap = true;
+                }
+            }
+            items.resize(selected);
+
+            components.Reset();
+            if(hasScrap)
+            {
+                world.Scrap(source, items, components);
+            }
+
+            for(const Item &item : items)
+            {
+                // An item that scraps into nothing is taken instead
+                bool isScrapped = (item.flags & kItemFlag_Scrap) != 0 && item.componentCount > 0;
+                if(actions.size() + (isScrapped ? 1 + item.componentCount : 1) > maxActions)
+                {
+                    return;
+                }
+
+                Action action;
+                action.source = source.ref;
+                action.item = item.form;
+                action.count = (UInt32)item.count;
+                action.flags = sourceFlags;
+                if((item.flags & kItemFlag_Legendary) != 0)
+                {
+                    action.flags |= kLootAction_Legendary;
+                }
+                if(isScrapped)
+                {
+                    action.flags |= kLootAction_Scrap;
+                }
+                actions.push_back(action);
+
+                if(!isScrapped)
+                {
+                    continue;
+                }
+
+                for(UInt32 i = item.firstComponent; i < item.firstComponent + item.componentCount; i++)
+                {
+                    Action component;
+                    component.source = source.ref;
+                    component.item = components[i].form;
+                    component.count = components[i].count;
+                    component.flags = sourceFlags | kLootAction_Component;
+                    actions.push_back(component);
+                }
+            }
+        }
+    }
+}
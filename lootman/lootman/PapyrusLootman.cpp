@@ -1,24 +1,35 @@
 ﻿#include "PapyrusLootman.h"
 
 #include <algorithm>
-#include <map>
+#include <sstream>
+#include <unordered_map>
 #include <unordered_set>
 #include <vector>
 
 #include "f4se/PapyrusVM.h"
 #include "f4se/PapyrusNativeFunctions.h"
+#include "f4se/PapyrusDelayFunctors.h"
+#include "f4se/PluginAPI.h"
 
 #include "f4se/GameData.h"
 #include "f4se/GameExtraData.h"
 #include "f4se/GameReferences.h"
 #include "f4se/GameRTTI.h"
 
+#include "ConstructibleObjectIndex.h"
+#include "FormClassCache.h"
 #include "FormIDCache.h"
+#include "FormTypeMask.h"
+#include "FormUtil.h"
 #include "InjectionData.h"
+#include "InventoryDigestCache.h"
+#include "LootPlanner.h"
+#include "PreScanWorker.h"
+#include "ScrapResultCache.h"
+#include "Scratch.h"
 
 #ifdef _DEBUG
 
-#include <sstream>
 #include <chrono>
 #include <iomanip>
 
@@ -29,16 +40,24 @@
 namespace PapyrusLootman
 {
     DECLARE_STRUCT(MiscComponent, "MiscObject")
+    DECLARE_STRUCT(FoundReference, "Lootman")
+    DECLARE_STRUCT(LootAction, "Lootman")
+    DECLARE_STRUCT(InventoryItem, "Lootman")
+
+    // The latent functions are queued to the delay functor manager of F4SE, not to the one linked into the plugin
+    F4SEObjectInterface * objectInterface = nullptr;
 
     struct ObjectReferenceWithDistance
     {
         TESObjectREFR * ref;
         float distance;
+        UInt8 formType;
 
-        ObjectReferenceWithDistance(TESObjectREFR * ptr, float num)
+        ObjectReferenceWithDistance(TESObjectREFR * ptr, float num, UInt8 type)
         {
             ref = ptr;
             distance = num;
+            formType = type;
         }
 
         bool operator<(const ObjectReferenceWithDistance &other) const
@@ -48,173 +67,367 @@ namespace PapyrusLootman
         }
     };
 
-    // Get all mod data from extradata
-    VMArray<BGSMod::Attachment::Mod *> _GetAllMods(ExtraDataList * extraDataList)
+    // Sums of component counts in a flat array indexed by the component number of ConstructibleObjectIndex. The array is zeroed
+    // again as the sums are taken, so the next call can reuse it without clearing it
+    class ComponentAccumulator
     {
-        VMArray<BGSMod::Attachment::Mod *> result;
-
-        if(!extraDataList)
+    public:
+        void Add(UInt32 index, UInt32 count)
         {
-            return result;
-        }
+            if(counts.size() <= index)
+            {
+                counts.resize(ConstructibleObjectIndex::GetComponentCount(), 0);
+            }
 
-        BSExtraData * extraData = extraDataList->GetByType(ExtraDataType::kExtraData_ObjectInstance);
-        if(!extraData)
-        {
-            return result;
+            // A count is stored plus one, so that zero means the component has not been touched even if a recipe needs none of it
+            if(counts[index] == 0)
+            {
+                touched.push_back(index);
+                counts[index] = 1;
+            }
+            counts[index] += count;
         }
 
-        BGSObjectInstanceExtra * objectModData = DYNAMIC_CAST(extraData, BSExtraData, BGSObjectInstanceExtra);
-        if(!objectModData)
+        void Add(const std::vector<ConstructibleObjectIndex::ComponentCount> * recipe, UInt32 multiplier)
         {
-            return result;
-        }
+            if(!recipe)
+            {
+                return;
+            }
 
-        BGSObjectInstanceExtra::Data * data = objectModData->data;
-        if(!data || !data->forms)
-        {
-            return result;
+            for(const ConstructibleObjectIndex::ComponentCount &element : *recipe)
+            {
+                Add(element.index, element.count * multiplier);
+            }
         }
 
-        for(UInt32 i = 0; i < (data->blockSize / sizeof(BGSObjectInstanceExtra::Data::Form)); i++)
+        // Call the functor with the index and the sum of every touched component, ordered by the address of the component
+        template<typename F>
+        void Take(F f)
         {
-            BGSMod::Attachment::Mod * objectMod = (BGSMod::Attachment::Mod *)Runtime_DynamicCast(LookupFormByID(data->forms[i].formId), RTTI_TESForm, RTTI_BGSMod__Attachment__Mod);
+            std::sort(touched.begin(), touched.end(), [](UInt32 a, UInt32 b)
+            {
+                return ConstructibleObjectIndex::GetComponent(a) < ConstructibleObjectIndex::GetComponent(b);
+            });
 
-            if(!objectMod)
+            for(UInt32 index : touched)
             {
-                continue;
+                f(index, counts[index] - 1);
+                counts[index] = 0;
             }
-
-            result.Push(&objectMod);
+            touched.Reset();
         }
 
-        return result;
-    }
+    private:
+        std::vector<UInt32> counts;
+        Scratch::Vector<UInt32> touched;
+    };
 
-    // Verify that the Legendary is present in the Mod list
-    bool _HasLegendaryMod(VMArray<BGSMod::Attachment::Mod *> mods)
+    // A stack of an inventory to scrap, copied under the inventory lock
+    struct ScrapStack
     {
-        for(UInt32 i = 0; i < mods.Length(); i++)
-        {
-            BGSMod::Attachment::Mod * objectMod = nullptr;
-            mods.Get(&objectMod, i);
-
-            // The 25th bit is the flag for the Legendary item (probably)
-            if(objectMod->flags == 25)
-            {
-                return true;
-            }
-        }
-        return false;
-    }
+        TESForm * form;
+        SInt32 count;
+        UInt32 firstModId;  // Range of the stack's mod IDs in the mod ID buffer
+        UInt32 modIdCount;
+    };
 
-    // Verify that the form is playable
-    bool _IsPlayable(TESForm * form)
+    // Temporaries of the scans. Kept per thread and reused by the next scan on the thread
+    struct ScanScratch
     {
-        return form && (form->flags & 1 << 2) == 0;
-    }
+        Scratch::IDSet knownIds;
+        Scratch::Vector<UInt32> hits;
+        Scratch::Vector<ObjectReferenceWithDistance> foundObjects;
+        Scratch::IDMap resolvedCells;
+        Scratch::Vector<UInt32> cellIds;
+
+        // Scrap evaluation of an object, and the totals of an inventory
+        ComponentAccumulator scrapComponents;
+        ComponentAccumulator inventoryScrapComponents;
+        Scratch::Vector<ScrapStack> scrapStacks;
+        Scratch::Vector<UInt32> scrapModIds;
+        Scratch::Vector<UInt32> stackModIds;    // Mod IDs of the object or stack being scrapped
+        Scratch::Vector<UInt32> scrapKey;       // Key of the object or stack being scrapped in ScrapResultCache
+
+        // Loot plan
+        Scratch::Vector<LootPlanner::Source> planSources;
+        Scratch::Vector<LootPlanner::Action> planActions;
+        LootPlanner::Workspace planWorkspace;
+    };
+
+    // Only a pointer can be thread local here, the scratch itself is created by the first scan on the thread
+    __declspec(thread) ScanScratch * scanScratch = nullptr;
 
-    // Verify that an object reference is a native object that cannot be manipulated by papyrus
-    bool _IsNativeObject(TESObjectREFR * ref)
+    ScanScratch & _GetScanScratch()
     {
-        return (ref->formID >> 24) == 0xFF && (ref->baseForm->formID >> 24) == 0xFF && (ref->flags & 1 << 14) != 0;
+        if(!scanScratch)
+        {
+            scanScratch = new ScanScratch();
+        }
+        return *scanScratch;
     }
 
-    // Retrieves objects that exist within a certain range starting from a specified object, and returns the objects filtered by form type
-    VMArray<TESObjectREFR *> FindAllReferencesOfFormType(StaticFunctionTag *, TESObjectREFR * ref, UInt32 range, UInt32 formType)
+    // Verify that the object is a lootable object of the form types within a certain range, and return the distance to it. Returns a negative value if it is not.
+    // Objects excluded by the injection data are also rejected if requested, so that they never reach papyrus
+    float _GetDistanceIfFound(TESObjectREFR * obj, const NiPoint3 &origin, UInt32 range, const FormTypeMask &formTypes, bool applyExclusions)
     {
+        // Ignore deleted or disabled objects.
+        if((obj->flags & (TESForm::kFlag_IsDeleted | TESForm::kFlag_IsDisabled)) != 0)
+        {
+            return -1;
+        }
+
+        TESForm * form = obj->baseForm;
+        if(!formTypes.Test(form->formType))
+        {
+            return -1;
+        }
+
+        UInt8 formClass = FormClassCache::Get(form);
+        if((formClass & FormClassCache::kClass_Playable) == 0)
+        {
+            return -1;
+        }
+
+        // Ignore native objects that cannot be bound to papyrus. Same as FormUtil::IsNativeObject, with the base form part classified beforehand
+        if((formClass & FormClassCache::kClass_Created) != 0 && (obj->formID >> 24) == 0xFF && (obj->flags & 1 << 14) != 0)
+        {
 #ifdef _DEBUG
-        const char * processId = _GetRandomProcessID();
-        _MESSAGE("| %s | *** FindAllReferencesOfFormType start ***", processId);
+            const char * processId = _GetRandomProcessID();
+            _MESSAGE("| %s |   ** Maybe a native object **", processId);
+            _TraceTESObjectREFR(processId, obj, 2);
 #endif
-        VMArray<TESObjectREFR *> result;
+            return -1;
+        }
 
-        if(!ref)
+        if(applyExclusions && ((formClass & FormClassCache::kClass_Excluded) != 0 || InjectionData::IsExcludedReference(obj)))
         {
-            return result;
+            return -1;
+        }
+
+        NiPoint3 pos = obj->pos;
+        float x = origin.x - pos.x;
+        float y = origin.y - pos.y;
+        float z = origin.z - pos.z;
+        float distance = std::sqrtf((x * x) + (y * y) + (z * z));
+
+        // Ignore objects with a distance of 0 because they are players
+        if(distance == 0 || distance > range)
+        {
+            return -1;
         }
 
+        return distance;
+    }
+
+    // Explore the cells for the objects of the form types that exist within a certain range starting from a specified object. Each object is visited once regardless of the number of form types
+    void _ScanReferences(TESObjectREFR * ref, UInt32 range, const FormTypeMask &formTypes, bool applyExclusions, std::vector<ObjectReferenceWithDistance> &foundObjects)
+    {
         TESObjectCELL * cell = ref->parentCell;
         if(!cell)
         {
-            return result;
+            return;
         }
 
-        std::unordered_set<UInt32> knownId;
-        std::vector<ObjectReferenceWithDistance> foundObjects;
+        ScanScratch &scratch = _GetScanScratch();
+        Scratch::IDSet &knownIds = scratch.knownIds;
+        knownIds.Clear();
         NiPoint3 pos1 = ref->pos;
 
-        auto find = [&](TESObjectCELL * cell)
+        auto check = [&](TESObjectREFR * obj)
         {
-            for(int i = 0; i < cell->objectList.count; i++)
+            float distance = _GetDistanceIfFound(obj, pos1, range, formTypes, applyExclusions);
+            if(distance < 0 || !knownIds.Insert(obj->formID))
             {
-                TESObjectREFR * obj = cell->objectList.entries[i];
-                if(!obj)
+                return;
+            }
+
+            foundObjects.push_back(ObjectReferenceWithDistance(obj, distance, obj->baseForm->formType));
+        };
+
+        // The current cell is always explored directly so that objects that have moved since they were indexed are not missed
+        for(int i = 0; i < cell->objectList.count; i++)
+        {
+            TESObjectREFR * obj = cell->objectList.entries[i];
+            if(obj)
+            {
+                check(obj);
+            }
+        }
+
+        // Other cells are explored through the spatial index, only the grid squares that overlap the search range are visited.
+        // The range is padded because the index has the positions of the objects when they were loaded, and the check uses where they are now
+        UInt32 spaceId = FormIDCache::GetSpaceID(cell);
+        FormIDCache::Sweep(spaceId);
+
+        // An interior is a single cell, which has already been explored
+        if((cell->flags & TESObjectCELL::kFlag_IsInterior) != 0)
+        {
+            return;
+        }
+
+        // Form types that are not indexed are found by walking the objects of the cells that have indexed references, as before the index.
+        // The walk checks every form type, so the index is not queried
+        if(!FormIDCache::GetIndexedFormTypes().Contains(formTypes))
+        {
+            Scratch::Vector<UInt32> &cellIds = scratch.cellIds;
+            cellIds.Reset();
+            {
+                SimpleLocker locker(&FormIDCache::lock);
+                for(auto &element : FormIDCache::cells)
                 {
-                    continue;
+                    if(element.second.spaceId == spaceId && element.first != cell->formID)
+                    {
+                        cellIds.push_back(element.first);
+                    }
                 }
+            }
 
-                // Ignore deleted or disabled objects.
-                if((obj->flags & (TESForm::kFlag_IsDeleted | TESForm::kFlag_IsDisabled)) != 0)
+            for(UInt32 cellId : cellIds)
+            {
+                TESObjectCELL * otherCell = DYNAMIC_CAST(LookupFormByID(cellId), TESForm, TESObjectCELL);
+                // Not explore cells that are not 3D loaded
+                if(!otherCell || (otherCell->flags & 16) == 0)
                 {
                     continue;
                 }
 
-                TESForm * form = obj->baseForm;
-                if(form->formType != formType || !_IsPlayable(form))
+                for(int i = 0; i < otherCell->objectList.count; i++)
                 {
-                    continue;
+                    TESObjectREFR * obj = otherCell->objectList.entries[i];
+                    if(obj)
+                    {
+                        check(obj);
+                    }
                 }
+            }
+            return;
+        }
 
-                // Ignore native objects that cannot be bound to papyrus
-                if(_IsNativeObject(obj))
+        // The snapshot is immutable, so neither the query nor the checks below hold the lock the loader threads write under
+        std::shared_ptr<const SpatialIndex::Snapshot> snapshot = FormIDCache::GetSnapshot();
+        UInt32 rejectFlags = SpatialIndex::kEntryFlag_NotPlayable | SpatialIndex::kEntryFlag_NativeObject;
+        if(applyExclusions)
+        {
+            rejectFlags |= SpatialIndex::kEntryFlag_Excluded;
+        }
+        // The cell pointers of the entries are used as is unless a cell has been detached since the snapshot was published
+        bool cellsAreValid = snapshot->GetStamp() == FormIDCache::GetCellGeneration();
+        Scratch::IDMap &resolvedCells = scratch.resolvedCells;
+        resolvedCells.Clear();
+        scratch.hits.Reset();
+        formTypes.ForEach([&](UInt8 formType)
+        {
+            snapshot->Query(spaceId, pos1.x, pos1.y, pos1.z, range + SpatialIndex::kPositionSlack, formType, rejectFlags, scratch.hits, [&](const SpatialIndex::Entry &entry)
+            {
+                void * resolvedCell = entry.cell;
+                if(!cellsAreValid && !resolvedCells.Find(entry.cellId, resolvedCell))
                 {
-#ifdef _DEBUG
-                    _MESSAGE("| %s |   ** Maybe a native object **", processId);
-                    _TraceTESObjectREFR(processId, obj, 2);
-#endif
-                    continue;
+                    resolvedCell = DYNAMIC_CAST(LookupFormByID(entry.cellId), TESForm, TESObjectCELL);
+                    resolvedCells.Insert(entry.cellId, resolvedCell);
                 }
 
-                if(!knownId.insert(obj->formID).second)
+                // Not explore cells that are not 3D loaded
+                TESObjectCELL * entryCell = (TESObjectCELL *)resolvedCell;
+                if(entryCell && (entryCell->flags & 16) != 0)
                 {
-                    continue;
+                    check((TESObjectREFR *)entry.ref);
                 }
+            });
+        });
+    }
+
+    // Collect the objects of the form types that exist within a certain range starting from a specified object.
+    // Scans from the player are answered from the list of the pre-scan worker while it is fresh enough
+    void _FindReferences(TESObjectREFR * ref, UInt32 range, const FormTypeMask &formTypes, bool applyExclusions, std::vector<ObjectReferenceWithDistance> &foundObjects)
+    {
+        if(ref == *g_player && ref->parentCell && FormIDCache::GetIndexedFormTypes().Contains(formTypes))
+        {
+            TESObjectCELL * cell = ref->parentCell;
+            NiPoint3 origin = ref->pos;
+            std::shared_ptr<const PreScanWorker::Result> preScan = PreScanWorker::GetResult(FormIDCache::GetSpaceID(cell), origin.x, origin.y, origin.z, range);
+            if(preScan)
+            {
+                Scratch::IDSet &knownIds = _GetScanScratch().knownIds;
+                knownIds.Clear();
 
-                NiPoint3 pos2 = obj->pos;
-                float x = pos1.x - pos2.x;
-                float y = pos1.y - pos2.y;
-                float z = pos1.z - pos2.z;
-                float distance = std::sqrtf((x * x) + (y * y) + (z * z));
+                auto check = [&](TESObjectREFR * obj)
+                {
+                    float distance = _GetDistanceIfFound(obj, origin, range, formTypes, applyExclusions);
+                    if(distance >= 0 && knownIds.Insert(obj->formID))
+                    {
+                        foundObjects.push_back(ObjectReferenceWithDistance(obj, distance, obj->baseForm->formType));
+                    }
+                };
 
-                // Ignore objects with a distance of 0 because they are players
-                if(distance == 0)
+                // The current cell is explored directly as in a full scan, the worker only lists what the index had
+                for(int i = 0; i < cell->objectList.count; i++)
                 {
-                    continue;
+                    TESObjectREFR * obj = cell->objectList.entries[i];
+                    if(obj)
+                    {
+                        check(obj);
+                    }
                 }
 
-                if(distance <= range)
+                // The worker never touches the objects, so every one of them that may be in range is looked up and checked here
+                for(const PreScanWorker::Reference &reference : preScan->references)
                 {
-                    foundObjects.push_back(ObjectReferenceWithDistance(obj, distance));
+                    if(!reference.MayBeWithin(origin.x, origin.y, origin.z, (float)range))
+                    {
+                        continue;
+                    }
+
+                    TESObjectREFR * obj = DYNAMIC_CAST(LookupFormByID(reference.formId), TESForm, TESObjectREFR);
+                    // The object may have been unloaded after the list was built
+                    if(obj && obj->parentCell && (obj->parentCell->flags & 16) != 0)
+                    {
+                        check(obj);
+                    }
                 }
+                return;
             }
-        };
+        }
 
-        find(cell);
+        _ScanReferences(ref, range, formTypes, applyExclusions, foundObjects);
+    }
 
+    // Keep only the specified number of the closest objects. Selection is linear, so only the kept objects are sorted afterwards
+    void _SelectNearest(std::vector<ObjectReferenceWithDistance> &foundObjects, UInt32 maxCount)
+    {
+        if(foundObjects.size() <= maxCount)
         {
-            SimpleLocker locker(&FormIDCache::lock);
-            for(auto it = FormIDCache::cells.begin(); it != FormIDCache::cells.end(); ++it)
-            {
-                cell = DYNAMIC_CAST(LookupFormByID(*it), TESForm, TESObjectCELL);
-                // Not explore cells that are not 3D loaded
-                if(cell && (cell->flags & 16) != 0)
-                {
-                    find(cell);
-                }
-            }
+            return;
+        }
+
+        std::nth_element(foundObjects.begin(), foundObjects.begin() + maxCount, foundObjects.end(), [](const ObjectReferenceWithDistance &a, const ObjectReferenceWithDistance &b)
+        {
+            return a.distance < b.distance;
+        });
+        foundObjects.erase(foundObjects.begin() + maxCount, foundObjects.end());
+    }
+
+    // Retrieves objects that exist within a certain range starting from a specified object, and returns the objects filtered by form type
+    VMArray<TESObjectREFR *> FindAllReferencesOfFormType(StaticFunctionTag *, TESObjectREFR * ref, UInt32 range, UInt32 formType)
+    {
+#ifdef _DEBUG
+        const char * processId = _GetRandomProcessID();
+        _MESSAGE("| %s | *** FindAllReferencesOfFormType start ***", processId);
+#endif
+        VMArray<TESObjectREFR *> result;
+
+        if(!ref || formType > 0xFF)
+        {
+            return result;
         }
 
+        FormTypeMask formTypes;
+        formTypes.Set((UInt8)formType);
+
+        Scratch::Vector<ObjectReferenceWithDistance> &foundObjects = _GetScanScratch().foundObjects;
+        foundObjects.Reset();
+        _FindReferences(ref, range, formTypes, false, foundObjects);
+
 #ifdef _DEBUG
         _MESSAGE("| %s |   ** Found objects **", processId);
 #endif
@@ -235,221 +448,963 @@ namespace PapyrusLootman
         return result;
     }
 
-    // Get and return only items of a specified form type from an inventory of object references
-    VMArray<TESForm *> GetInventoryItemsOfFormTypes(StaticFunctionTag *, TESObjectREFR * ref, VMArray<UInt32> formTypes)
+    VMArray<TESObjectREFR *> _FindAllReferencesOfFormTypeLatent(UInt32 stackId, StaticFunctionTag * base, TESObjectREFR * ref, UInt32 range, UInt32 formType)
     {
-#ifdef _DEBUG
-        const char * processId = _GetRandomProcessID();
-        _MESSAGE("| %s | *** GetInventoryItemsOfFormTypes start ***", processId);
-#endif
-        VMArray<TESForm *> result;
+        return FindAllReferencesOfFormType(base, ref, range, formType);
+    }
 
-        if(!ref || formTypes.IsNone())
+    // A functor is saved and restored under its class name, which must not collide with the ones registered by F4SE or other plugins.
+    // DECLARE_DELAY_FUNCTOR names every functor "structName", so the names are declared here
+    char findAllReferencesOfFormTypeFunctorName[] = "LootmanFindAllReferencesOfFormTypeFunctor";
+    typedef F4SEDelayFunctor3<findAllReferencesOfFormTypeFunctorName, _FindAllReferencesOfFormTypeLatent, StaticFunctionTag, VMArray<TESObjectREFR *>, TESObjectREFR *, UInt32, UInt32> LootmanFindAllReferencesOfFormTypeFunctor;
+
+    // Latent version of FindAllReferencesOfFormType. The scan runs on the tick of the delay functors, and the calling script waits without blocking the others
+    bool FindAllReferencesOfFormTypeLatent(VirtualMachine * vm, UInt32 stackId, StaticFunctionTag * base, TESObjectREFR * ref, UInt32 range, UInt32 formType)
+    {
+        if(!objectInterface || !ref)
         {
-            return result;
+            return false;
         }
 
+        objectInterface->GetDelayFunctorManager().Enqueue(new LootmanFindAllReferencesOfFormTypeFunctor(_FindAllReferencesOfFormTypeLatent, vm, stackId, base, ref, range, formType));
+        return true;
+    }
+
+    // Retrieves objects that exist within a certain range starting from a specified object, and returns only the specified number of the closest objects filtered by form type.
+    // If applyExclusions is true, objects excluded by the injection data are not returned
+    VMArray<TESObjectREFR *> FindNearestReferencesOfFormType(StaticFunctionTag *, TESObjectREFR * ref, UInt32 range, UInt32 formType, UInt32 maxCount, bool applyExclusions)
+    {
 #ifdef _DEBUG
-        _MESSAGE("| %s |   Target: [Name=%s, ID=%08X]", processId, CALL_MEMBER_FN(ref, GetReferenceName)(), ref->formID);
+        const char * processId = _GetRandomProcessID();
+        _MESSAGE("| %s | *** FindNearestReferencesOfFormType start ***", processId);
 #endif
+        VMArray<TESObjectREFR *> result;
 
-        BGSInventoryList * inventoryList = ref->inventoryList;
-        if(!inventoryList)
+        if(!ref || maxCount == 0 || formType > 0xFF)
         {
             return result;
         }
 
-        inventoryList->inventoryLock.LockForRead();
+        FormTypeMask formTypes;
+        formTypes.Set((UInt8)formType);
 
-        for(int i = 0; i < inventoryList->items.count; i++)
-        {
-            BGSInventoryItem item;
-            inventoryList->items.GetNthItem(i, item);
+        Scratch::Vector<ObjectReferenceWithDistance> &foundObjects = _GetScanScratch().foundObjects;
+        foundObjects.Reset();
+        _FindReferences(ref, range, formTypes, applyExclusions, foundObjects);
+        _SelectNearest(foundObjects, maxCount);
 
 #ifdef _DEBUG
-            _MESSAGE("| %s |   [Item %d]", processId, i);
-            _TraceBGSInventoryItem(processId, &item, 2);
+        _MESSAGE("| %s |   ** Found objects **", processId);
 #endif
-
-            TESForm * form = item.form;
-            if(!_IsPlayable(form))
-            {
-                continue;
-            }
-
-            UInt8 formType = form->formType;
-            bool formTypeIsInArray = false;
-            for(UInt32 j = 0; j < formTypes.Length(); j++)
-            {
-                UInt32 type;
-                formTypes.Get(&type, j);
-
-                if(type == -1)
-                {
-                    formTypeIsInArray = (formType == FormType::kFormType_ALCH) ||
-                                        (formType == FormType::kFormType_AMMO) ||
-                                        (formType == FormType::kFormType_ARMO) ||
-                                        (formType == FormType::kFormType_BOOK) ||
-                                        (formType == FormType::kFormType_INGR) ||
-                                        (formType == FormType::kFormType_KEYM) ||
-                                        (formType == FormType::kFormType_MISC) ||
-                                        (formType == FormType::kFormType_WEAP);
-                    break;
-                }
-                else if(formType == type)
-                {
-                    formTypeIsInArray = true;
-                    break;
-                }
-            }
-            if(!formTypeIsInArray)
-            {
-                continue;
-            }
-
-            if(form->formType == FormType::kFormType_WEAP)
-            {
-                bool isDroppedWeapon = false;
-                item.stack->Visit([&isDroppedWeapon](BGSInventoryItem::Stack * stack) mutable
-                {
-                    isDroppedWeapon = (stack->flags & 1 << 5) != 0;
-                    return !isDroppedWeapon;
-                });
+        std::sort(foundObjects.begin(), foundObjects.end());
+        for(ObjectReferenceWithDistance &element : foundObjects)
+        {
 #ifdef _DEBUG
-                _MESSAGE("| %s |       Is dropped weapon: %s", processId, isDroppedWeapon ? "true" : "false");
+            _MESSAGE("| %s |     Distance: [%f]", processId, element.distance);
+            _TraceTESObjectREFR(processId, element.ref, 2);
+            _TraceReferenceFlags(processId, element.ref, 3);
 #endif
-                if(isDroppedWeapon)
-                {
-                    continue;
-                }
-            }
-
-            result.Push(&form);
+            result.Push(&element.ref);
         }
 
-        inventoryList->inventoryLock.Unlock();
-
 #ifdef _DEBUG
-        _MESSAGE("| %s | *** GetInventoryItemsOfFormTypes end ***", processId);
+        _MESSAGE("| %s | *** FindNearestReferencesOfFormType end ***", processId);
 #endif
         return result;
     }
 
-    // Verify the object is a Legendary item. Returns false if the object is not playable, or if it is neither a weapon nor armor
-    bool IsLegendaryItem(StaticFunctionTag *, VMRefOrInventoryObj * ref)
+    // Retrieves objects that exist within a certain range starting from a specified object, and returns the objects of all the specified form types.
+    // The result is grouped in the order of the form types, and each group is sorted so that the closest object comes last. If applyExclusions is true, objects excluded by the injection data are not returned
+    VMArray<FoundReference> FindAllReferencesOfFormTypes(StaticFunctionTag *, TESObjectREFR * ref, UInt32 range, VMArray<UInt32> formTypes, bool applyExclusions)
     {
-        if(!ref)
-        {
-            return false;
-        }
+#ifdef _DEBUG
+        const char * processId = _GetRandomProcessID();
+        _MESSAGE("| %s | *** FindAllReferencesOfFormTypes start ***", processId);
+#endif
+        VMArray<FoundReference> result;
 
-        TESForm * baseForm = nullptr;
-        ExtraDataList * extraDataList = nullptr;
-        ref->GetExtraData(&baseForm, &extraDataList);
-        if(!_IsPlayable(baseForm) || (baseForm->formType != FormType::kFormType_WEAP && baseForm->formType != FormType::kFormType_ARMO))
+        if(!ref || formTypes.IsNone())
         {
-            return false;
+            return result;
         }
 
-        return _HasLegendaryMod(_GetAllMods(extraDataList));
-    }
-
-    // Verify the existence of the specified item's legendary in the object's inventory. Returns false if the item is not playable, or if it is neither a weapon nor armor
-    bool HasLegendaryItem(StaticFunctionTag *, TESObjectREFR * ref, TESForm * form)
-    {
-        if(!ref || !_IsPlayable(form) || (form->formType != FormType::kFormType_WEAP && form->formType != FormType::kFormType_ARMO))
+        FormTypeMask mask;
+        UInt8 groupOrder[256];
+        for(UInt32 i = 0; i < formTypes.Length(); i++)
         {
-            return false;
+            UInt32 formType;
+            formTypes.Get(&formType, i);
+            if(formType > 0xFF || mask.Test((UInt8)formType))
+            {
+                continue;
+            }
+
+            mask.Set((UInt8)formType);
+            groupOrder[formType] = (UInt8)(i > 0xFF ? 0xFF : i);
         }
 
-        BGSInventoryList * inventoryList = ref->inventoryList;
-        if(!inventoryList)
+        if(mask.IsEmpty())
         {
-            return false;
+            return result;
         }
 
-        inventoryList->inventoryLock.LockForRead();
+        Scratch::Vector<ObjectReferenceWithDistance> &foundObjects = _GetScanScratch().foundObjects;
+        foundObjects.Reset();
+        _FindReferences(ref, range, mask, applyExclusions, foundObjects);
 
-        for(int i = 0; i < inventoryList->items.count; i++)
+#ifdef _DEBUG
+        _MESSAGE("| %s |   ** Found objects **", processId);
+#endif
+        std::sort(foundObjects.begin(), foundObjects.end(), [&groupOrder](const ObjectReferenceWithDistance &a, const ObjectReferenceWithDistance &b)
         {
-            BGSInventoryItem item;
-            inventoryList->items.GetNthItem(i, item);
-
-            TESForm * formInInventory = item.form;
-            if(!formInInventory || formInInventory->formID != form->formID)
+            if(a.formType != b.formType)
             {
-                continue;
+                return groupOrder[a.formType] < groupOrder[b.formType];
             }
-
+            return a < b;
+        });
+        for(ObjectReferenceWithDistance &element : foundObjects)
+        {
 #ifdef _DEBUG
-            _TraceBGSInventoryItem(_GetRandomProcessID(), &item, 0);
+            _MESSAGE("| %s |     Distance: [%f], FormType: [%s]", processId, element.distance, _FormTypeToString(element.formType));
+            _TraceTESObjectREFR(processId, element.ref, 2);
 #endif
+            FoundReference found;
+            found.Set("ref", element.ref);
+            found.Set("formType", (UInt32)element.formType);
+            result.Push(&found);
+        }
 
-            bool hasLegendaryMod = false;
-            item.stack->Visit([&hasLegendaryMod](BGSInventoryItem::Stack * stack) mutable
+#ifdef _DEBUG
+        _MESSAGE("| %s | *** FindAllReferencesOfFormTypes end ***", processId);
+#endif
+        return result;
+    }
+
+    // Distance the scanning object may move from where the last full scan ran before a delta scan falls back to a full scan.
+    // The full scan collects candidates within the range plus this distance, so that the delta scans only examine those
+    const float kScanCursorTolerance = 512.0f;
+
+    // State of a delta scan. The cursor remembers the objects it has returned, so that only new objects are returned next time
+    struct ScanCursor
+    {
+        UInt32 generation;
+        UInt32 spaceId;
+        NiPoint3 origin;                        // Where the last full scan ran
+        UInt32 range;
+        UInt32 formType;
+        bool applyExclusions;
+        std::unordered_set<UInt32> returnedId;
+        std::unordered_set<UInt32> candidateId; // Objects within the range plus the tolerance of the origin
+    };
+
+    SimpleLock scanCursorLock;
+    std::unordered_map<UInt32, ScanCursor> scanCursors;
+    UInt32 nextScanCursorId = 1;
+
+    void _ResetScanCursor(ScanCursor &cursor)
+    {
+        cursor.generation = 0;
+        cursor.spaceId = 0;
+        cursor.range = 0;
+        cursor.formType = 0;
+        cursor.applyExclusions = false;
+        cursor.returnedId.clear();
+        cursor.candidateId.clear();
+    }
+
+    // Move the state of one cursor into another without copying the sets
+    void _MoveScanCursor(ScanCursor &from, ScanCursor &to)
+    {
+        to.generation = from.generation;
+        to.spaceId = from.spaceId;
+        to.origin = from.origin;
+        to.range = from.range;
+        to.formType = from.formType;
+        to.applyExclusions = from.applyExclusions;
+        to.returnedId.swap(from.returnedId);
+        to.candidateId.swap(from.candidateId);
+        _ResetScanCursor(from);
+    }
+
+    void ClearScanCursors()
+    {
+        SimpleLocker locker(&scanCursorLock);
+        scanCursors.clear();
+    }
+
+    // Open a cursor for FindReferencesSince and return its handle
+    UInt32 OpenScanCursor(StaticFunctionTag *)
+    {
+        SimpleLocker locker(&scanCursorLock);
+
+        _ResetScanCursor(scanCursors[nextScanCursorId]);
+        return nextScanCursorId++;
+    }
+
+    // Close the cursor opened by OpenScanCursor
+    void CloseScanCursor(StaticFunctionTag *, UInt32 cursorId)
+    {
+        SimpleLocker locker(&scanCursorLock);
+        scanCursors.erase(cursorId);
+    }
+
+    // Retrieves objects that exist within a certain range starting from a specified object, and returns only the objects that have appeared or come into the range since the last call with the cursor.
+    // While the object stays near where the last full scan ran, only the candidates of that scan, the references loaded since the last call and the references
+    // that move on their own are examined instead of the whole range.
+    // If applyExclusions is true, objects excluded by the injection data are not returned
+    VMArray<TESObjectREFR *> FindReferencesSince(StaticFunctionTag *, UInt32 cursorId, TESObjectREFR * ref, UInt32 range, UInt32 formType, bool applyExclusions)
+    {
+#ifdef _DEBUG
+        const char * processId = _GetRandomProcessID();
+        _MESSAGE("| %s | *** FindReferencesSince start ***", processId);
+#endif
+        VMArray<TESObjectREFR *> result;
+
+        if(!ref || !ref->parentCell || formType > 0xFF)
+        {
+            return result;
+        }
+
+        // The state is taken out of the cursor so that the scan runs without the lock. A cursor used by two calls at once starts over for the later one
+        ScanCursor cursor;
+        {
+            SimpleLocker locker(&scanCursorLock);
+
+            // Cursors are not saved, so a handle restored from a save starts over as a new cursor
+            auto cursorIt = scanCursors.find(cursorId);
+            if(cursorIt == scanCursors.end())
+            {
+                cursorIt = scanCursors.insert(std::make_pair(cursorId, ScanCursor())).first;
+                _ResetScanCursor(cursorIt->second);
+                if(nextScanCursorId <= cursorId)
+                {
+                    nextScanCursorId = cursorId + 1;
+                }
+            }
+
+            _MoveScanCursor(cursorIt->second, cursor);
+        }
+
+        FormTypeMask formTypes;
+        formTypes.Set((UInt8)formType);
+
+        NiPoint3 origin = ref->pos;
+        UInt32 spaceId = FormIDCache::GetSpaceID(ref->parentCell);
+        // Only the references of indexed form types are recorded when they are loaded, the others are always found by a full scan
+        float dx = origin.x - cursor.origin.x;
+        float dy = origin.y - cursor.origin.y;
+        float dz = origin.z - cursor.origin.z;
+        bool isSameScan = FormIDCache::GetIndexedFormTypes().Test((UInt8)formType) && cursor.generation != 0 && cursor.spaceId == spaceId && cursor.range == range && cursor.formType == formType && cursor.applyExclusions == applyExclusions &&
+                          (dx * dx) + (dy * dy) + (dz * dz) <= kScanCursorTolerance * kScanCursorTolerance;
+
+        std::vector<ObjectReferenceWithDistance> foundObjects;
+        std::vector<UInt32> indexedIds;
+        UInt32 generation;
+        if(isSameScan && FormIDCache::GetIndexedSince(cursor.generation, indexedIds, generation))
+        {
+            std::unordered_set<UInt32> knownId;
+            auto examine = [&](TESObjectREFR * obj, bool isReloaded)
+            {
+                if(!knownId.insert(obj->formID).second)
+                {
+                    return;
+                }
+
+                float distance = _GetDistanceIfFound(obj, origin, range, formTypes, applyExclusions);
+                if(distance < 0)
+                {
+                    // Forgotten, so that it is returned again when it comes back into the range
+                    cursor.returnedId.erase(obj->formID);
+                    return;
+                }
+
+                // A reloaded object is returned again even if it has already been returned
+                if(cursor.returnedId.insert(obj->formID).second || isReloaded)
+                {
+                    foundObjects.push_back(ObjectReferenceWithDistance(obj, distance, obj->baseForm->formType));
+                }
+            };
+
+            UInt32 paddedRange = range + (UInt32)kScanCursorTolerance;
+            for(UInt32 formId : indexedIds)
+            {
+                TESObjectREFR * obj = DYNAMIC_CAST(LookupFormByID(formId), TESForm, TESObjectREFR);
+                if(obj)
+                {
+                    examine(obj, true);
+
+                    // Loaded near the origin of the full scan, so it is a candidate of the next delta scans as well
+                    if(_GetDistanceIfFound(obj, cursor.origin, paddedRange, formTypes, applyExclusions) >= 0)
+                    {
+                        cursor.candidateId.insert(obj->formID);
+                    }
+                }
+            }
+
+            // The candidates of the full scan cover every object that has stayed in place and can be within the range of the current position
+            for(UInt32 formId : cursor.candidateId)
+            {
+                TESObjectREFR * obj = DYNAMIC_CAST(LookupFormByID(formId), TESForm, TESObjectREFR);
+                if(obj && obj->parentCell && (obj->parentCell->flags & 16) != 0)
+                {
+                    examine(obj, false);
+                }
+            }
+
+            // Objects of the scanner's cell are read directly as _ScanReferences does, so that the ones pushed around are not missed
+            TESObjectCELL * cell = ref->parentCell;
+            for(int i = 0; i < cell->objectList.count; i++)
+            {
+                TESObjectREFR * obj = cell->objectList.entries[i];
+                if(obj)
+                {
+                    examine(obj, false);
+                }
+            }
+
+            // Actors walk into the range from anywhere in the space. They are looked up by ID, because they may have been unloaded since the snapshot was published
+            UInt32 rejectFlags = SpatialIndex::kEntryFlag_NotPlayable | SpatialIndex::kEntryFlag_NativeObject;
+            auto examineMovable = [&](const SpatialIndex::Entry &entry)
             {
-                if(_HasLegendaryMod(_GetAllMods(stack->extraData)))
+                TESObjectREFR * obj = DYNAMIC_CAST(LookupFormByID(entry.formId), TESForm, TESObjectREFR);
+                if(obj && obj->parentCell && (obj->parentCell->flags & 16) != 0)
                 {
-                    hasLegendaryMod = true;
-                    return false;
+                    examine(obj, false);
                 }
+            };
+            FormIDCache::GetSnapshot()->QueryMovable(spaceId, (UInt8)formType, rejectFlags, examineMovable);
+        }
+        else
+        {
+            // Take the generation before scanning, so that objects loaded during the scan are examined next time
+            generation = FormIDCache::GetGeneration();
+
+            // Padded by the tolerance, so that the delta scans of the next calls find their candidates here
+            std::vector<ObjectReferenceWithDistance> inRangeObjects;
+            _FindReferences(ref, range + (UInt32)kScanCursorTolerance, formTypes, applyExclusions, inRangeObjects);
+
+            std::unordered_set<UInt32> inRangeId;
+            cursor.candidateId.clear();
+            for(ObjectReferenceWithDistance &element : inRangeObjects)
+            {
+                cursor.candidateId.insert(element.ref->formID);
+                if(element.distance > range)
+                {
+                    continue;
+                }
+
+                inRangeId.insert(element.ref->formID);
+                if(cursor.returnedId.find(element.ref->formID) == cursor.returnedId.end())
+                {
+                    foundObjects.push_back(element);
+                }
+            }
+
+            cursor.returnedId.swap(inRangeId);
+            cursor.spaceId = spaceId;
+            cursor.origin = origin;
+            cursor.range = range;
+            cursor.formType = formType;
+            cursor.applyExclusions = applyExclusions;
+        }
+        cursor.generation = generation;
+
+        // Put the state back, unless the cursor has been closed during the scan
+        {
+            SimpleLocker locker(&scanCursorLock);
+
+            auto cursorIt = scanCursors.find(cursorId);
+            if(cursorIt != scanCursors.end())
+            {
+                _MoveScanCursor(cursor, cursorIt->second);
+            }
+        }
+
+#ifdef _DEBUG
+        _MESSAGE("| %s |   ** Found objects **", processId);
+#endif
+        std::sort(foundObjects.begin(), foundObjects.end());
+        for(ObjectReferenceWithDistance &element : foundObjects)
+        {
+#ifdef _DEBUG
+            _MESSAGE("| %s |     Distance: [%f]", processId, element.distance);
+            _TraceTESObjectREFR(processId, element.ref, 2);
+#endif
+            result.Push(&element.ref);
+        }
+
+#ifdef _DEBUG
+        _MESSAGE("| %s | *** FindReferencesSince end ***", processId);
+#endif
+        return result;
+    }
+
+    // State of a scan split over several calls. Only IDs are kept between the calls, because objects may be unloaded in between
+    struct BudgetedScan
+    {
+        enum
+        {
+            kPhase_CurrentCell,
+            kPhase_Index,
+            kPhase_Done
+        };
+
+        UInt32 phase;
+        NiPoint3 origin;
+        UInt32 range;
+        FormTypeMask formTypes;
+        bool applyExclusions;
+
+        UInt32 cellId;
+        bool isInterior;
+        UInt32 spaceId;
+        UInt32 objectIndex;
+
+        // Position in the index: the form type and the grid square to query next. The snapshot is not kept, as its entries point to
+        // objects that may be unloaded between two calls
+        std::vector<UInt8> types;
+        UInt32 typeIndex;
+        float queryRadius;
+        SInt32 minX, maxX, minY, maxY;
+        SInt32 gx, gy;
+        UInt32 movablePosition;     // Position in the movable entries of the form type, which are visited before its squares
+
+        std::unordered_set<UInt32> knownId;
+        std::vector<std::pair<UInt32, float>> found;
+        UInt32 slices;
+
+        // Held by the slice running on the scan, so that the slices of other scans run at the same time
+        SimpleLock lock;
+    };
+
+    // Guards the map of the scans, the next handle and the instrumentation, and is never held while a scan runs
+    SimpleLock budgetedScanLock;
+    std::unordered_map<UInt32, std::shared_ptr<BudgetedScan>> budgetedScans;
+    UInt32 nextBudgetedScanId = 1;
+
+    // Instrumentation of the budgeted scans
+    UInt32 completedBudgetedScans = 0;
+    UInt32 totalBudgetedScanSlices = 0;
+    UInt32 maxBudgetedScanSlices = 0;
+
+    // Number of objects examined between the checks of the clock
+    const UInt32 kBudgetCheckInterval = 16;
+
+    void ClearBudgetedScans()
+    {
+        SimpleLocker locker(&budgetedScanLock);
+        budgetedScans.clear();
+    }
+
+    // Start a scan that is split over several calls of ContinueBudgetedScan, and return its handle. Returns 0 if the object is not in a cell
+    UInt32 StartBudgetedScan(StaticFunctionTag *, TESObjectREFR * ref, UInt32 range, VMArray<UInt32> formTypes, bool applyExclusions)
+    {
+        if(!ref || !ref->parentCell || formTypes.IsNone())
+        {
+            return 0;
+        }
+
+        std::shared_ptr<BudgetedScan> scanPtr = std::make_shared<BudgetedScan>();
+        BudgetedScan &scan = *scanPtr;
+        scan.phase = BudgetedScan::kPhase_CurrentCell;
+        scan.origin = ref->pos;
+        scan.range = range;
+        scan.applyExclusions = applyExclusions;
+        for(UInt32 i = 0; i < formTypes.Length(); i++)
+        {
+            UInt32 formType;
+            formTypes.Get(&formType, i);
+            if(formType <= 0xFF)
+            {
+                scan.formTypes.Set((UInt8)formType);
+            }
+        }
+        scan.formTypes.ForEach([&scan](UInt8 formType)
+        {
+            scan.types.push_back(formType);
+        });
+
+        scan.cellId = ref->parentCell->formID;
+        scan.isInterior = (ref->parentCell->flags & TESObjectCELL::kFlag_IsInterior) != 0;
+        scan.spaceId = FormIDCache::GetSpaceID(ref->parentCell);
+        scan.objectIndex = 0;
+
+        // Padded in the same way as _ScanReferences
+        scan.typeIndex = 0;
+        scan.queryRadius = range + SpatialIndex::kPositionSlack;
+        scan.minX = SpatialIndex::ToGrid(scan.origin.x - scan.queryRadius);
+        scan.maxX = SpatialIndex::ToGrid(scan.origin.x + scan.queryRadius);
+        scan.minY = SpatialIndex::ToGrid(scan.origin.y - scan.queryRadius);
+        scan.maxY = SpatialIndex::ToGrid(scan.origin.y + scan.queryRadius);
+        scan.gx = scan.minX;
+        scan.gy = scan.minY;
+        scan.movablePosition = 0;
+
+        scan.slices = 0;
+
+        SimpleLocker locker(&budgetedScanLock);
+        UInt32 scanId = nextBudgetedScanId++;
+        budgetedScans[scanId] = scanPtr;
+        return scanId;
+    }
+
+    // Continue the scan for about the budget in microseconds. Returns true when the scan is complete, or if the handle is unknown
+    bool ContinueBudgetedScan(StaticFunctionTag *, UInt32 scanId, UInt32 budget)
+    {
+        LARGE_INTEGER frequency, start, now;
+        QueryPerformanceFrequency(&frequency);
+        QueryPerformanceCounter(&start);
+        LONGLONG budgetTicks = (LONGLONG)budget * frequency.QuadPart / 1000000;
+
+        std::shared_ptr<BudgetedScan> scanPtr;
+        {
+            SimpleLocker locker(&budgetedScanLock);
+
+            auto scanIt = budgetedScans.find(scanId);
+            if(scanIt == budgetedScans.end())
+            {
                 return true;
-            });
+            }
+            scanPtr = scanIt->second;
+        }
+
+        // The scan stays alive while the slice runs, even if it is finished or cleared in the meantime
+        BudgetedScan &scan = *scanPtr;
+        SimpleLocker scanLocker(&scan.lock);
+        if(scan.phase == BudgetedScan::kPhase_Done)
+        {
+            return true;
+        }
+        scan.slices++;
 
-            if(hasLegendaryMod)
+        UInt32 examined = 0;
+        auto isOverBudget = [&]() -> bool
+        {
+            if(++examined % kBudgetCheckInterval != 0)
             {
+                return false;
+            }
+            QueryPerformanceCounter(&now);
+            return now.QuadPart - start.QuadPart >= budgetTicks;
+        };
+
+        auto check = [&](TESObjectREFR * obj)
+        {
+            float distance = _GetDistanceIfFound(obj, scan.origin, scan.range, scan.formTypes, scan.applyExclusions);
+            if(distance >= 0 && scan.knownId.insert(obj->formID).second)
+            {
+                scan.found.push_back(std::make_pair(obj->formID, distance));
+            }
+        };
+
+        if(scan.phase == BudgetedScan::kPhase_CurrentCell)
+        {
+            // The cell may have been unloaded since the last call, and its object list may have changed, so both are read every time
+            TESObjectCELL * cell = DYNAMIC_CAST(LookupFormByID(scan.cellId), TESForm, TESObjectCELL);
+            if(cell && (cell->flags & 16) != 0)
+            {
+                for(; scan.objectIndex < cell->objectList.count; scan.objectIndex++)
+                {
+                    if(isOverBudget())
+                    {
+                        return false;
+                    }
+
+                    TESObjectREFR * obj = cell->objectList.entries[scan.objectIndex];
+                    if(obj)
+                    {
+                        check(obj);
+                    }
+                }
+            }
+
+            // An interior is a single cell, which has already been explored
+            if(scan.isInterior)
+            {
+                scan.phase = BudgetedScan::kPhase_Done;
                 return true;
             }
+
+            scan.phase = BudgetedScan::kPhase_Index;
         }
 
-        inventoryList->inventoryLock.Unlock();
+        // Every call queries the latest snapshot, so that only objects that are still indexed are visited
+        std::shared_ptr<const SpatialIndex::Snapshot> snapshot = FormIDCache::GetSnapshot();
+        bool cellsAreValid = snapshot->GetStamp() == FormIDCache::GetCellGeneration();
+        UInt32 rejectFlags = SpatialIndex::kEntryFlag_NotPlayable | SpatialIndex::kEntryFlag_NativeObject;
+        if(scan.applyExclusions)
+        {
+            rejectFlags |= SpatialIndex::kEntryFlag_Excluded;
+        }
 
-        return false;
+        ScanScratch &scratch = _GetScanScratch();
+        scratch.hits.Reset();
+        auto checkEntry = [&](const SpatialIndex::Entry &entry)
+        {
+            TESObjectCELL * entryCell = cellsAreValid ? (TESObjectCELL *)entry.cell : DYNAMIC_CAST(LookupFormByID(entry.cellId), TESForm, TESObjectCELL);
+            if(entryCell && (entryCell->flags & 16) != 0)
+            {
+                check((TESObjectREFR *)entry.ref);
+            }
+        };
+
+        // A grid square is the unit of the slices in the index phase. The movable objects of a form type are visited before its squares,
+        // and count against the budget one by one. The position is kept across snapshots: a movable entry removed in between shifts
+        // the ones after it, which may then be skipped by this scan in the same way as objects loaded after it started
+        for(; scan.typeIndex < scan.types.size(); scan.typeIndex++)
+        {
+            if(!snapshot->QueryMovable(scan.spaceId, scan.types[scan.typeIndex], rejectFlags, scan.movablePosition, isOverBudget, checkEntry))
+            {
+                return false;
+            }
+
+            for(; scan.gx <= scan.maxX; scan.gx++, scan.gy = scan.minY)
+            {
+                for(; scan.gy <= scan.maxY; scan.gy++)
+                {
+                    QueryPerformanceCounter(&now);
+                    if(now.QuadPart - start.QuadPart >= budgetTicks)
+                    {
+                        return false;
+                    }
+
+                    snapshot->QuerySquare(scan.spaceId, scan.gx, scan.gy, scan.origin.x, scan.origin.y, scan.origin.z, scan.queryRadius,
+                                          scan.types[scan.typeIndex], rejectFlags, scratch.hits, checkEntry);
+                }
+            }
+            scan.gx = scan.minX;
+            scan.gy = scan.minY;
+            scan.movablePosition = 0;
+        }
+
+        scan.phase = BudgetedScan::kPhase_Done;
+        return true;
     }
 
-    // Get and return the injection data to be registered in the form list
-    VMArray<TESForm *> GetInjectionDataForList(StaticFunctionTag *, BSFixedString identify)
+    // Finish the scan and return the objects found, sorted so that the closest object comes last. The handle is released.
+    // Objects unloaded since they were found are left out
+    VMArray<FoundReference> FinishBudgetedScan(StaticFunctionTag *, UInt32 scanId)
+    {
+        VMArray<FoundReference> result;
+
+        std::shared_ptr<BudgetedScan> scanPtr;
+        {
+            SimpleLocker locker(&budgetedScanLock);
+
+            auto scanIt = budgetedScans.find(scanId);
+            if(scanIt == budgetedScans.end())
+            {
+                return result;
+            }
+            scanPtr = scanIt->second;
+            budgetedScans.erase(scanIt);
+        }
+
+        // Wait for a slice still running on the scan
+        BudgetedScan &scan = *scanPtr;
+        SimpleLocker scanLocker(&scan.lock);
+        if(scan.phase == BudgetedScan::kPhase_Done)
+        {
+            SimpleLocker locker(&budgetedScanLock);
+            completedBudgetedScans++;
+            totalBudgetedScanSlices += scan.slices;
+            maxBudgetedScanSlices = (std::max)(maxBudgetedScanSlices, scan.slices);
+#ifdef _DEBUG
+            _MESSAGE("| BudgetedScan | Slices: %d, Found: %d", scan.slices, scan.found.size());
+#endif
+        }
+
+        std::sort(scan.found.begin(), scan.found.end(), [](const std::pair<UInt32, float> &a, const std::pair<UInt32, float> &b)
+        {
+            return a.second > b.second;
+        });
+
+        for(auto &element : scan.found)
+        {
+            TESObjectREFR * obj = DYNAMIC_CAST(LookupFormByID(element.first), TESForm, TESObjectREFR);
+            if(!obj || !obj->parentCell || (obj->parentCell->flags & 16) == 0 || (obj->flags & (TESForm::kFlag_IsDeleted | TESForm::kFlag_IsDisabled)) != 0)
+            {
+                continue;
+            }
+
+            FoundReference found;
+            found.Set("ref", obj);
+            found.Set("formType", (UInt32)obj->baseForm->formType);
+            result.Push(&found);
+        }
+
+        return result;
+    }
+
+    // Get and return the number of slices the budgeted scans took
+    BSFixedString GetBudgetedScanStats(StaticFunctionTag *)
     {
+        SimpleLocker locker(&budgetedScanLock);
+        std::stringstream ss;
+        ss << "Completed scans: " << completedBudgetedScans << ", Total slices: " << totalBudgetedScanSlices << ", Max slices: " << maxBudgetedScanSlices;
+        if(completedBudgetedScans > 0)
+        {
+            ss << ", Average slices: " << (float)totalBudgetedScanSlices / completedBudgetedScans;
+        }
+        return ss.str().c_str();
+    }
+
+    // Start or stop the pre-scan worker. While it runs, scans from the player within the range are answered from a snapshot
+    // that is at most maxAge milliseconds old and taken within maxDisplacement units of the player
+    void ConfigurePreScan(StaticFunctionTag *, bool enabled, UInt32 range, UInt32 maxAge, UInt32 maxDisplacement)
+    {
+        PreScanWorker::Configure(enabled, range, maxAge, maxDisplacement);
+        _MESSAGE(">> Pre-scan worker is configured: [enabled: %d, range: %d, max age: %d, max displacement: %d]", enabled, range, maxAge, maxDisplacement);
+    }
+
+    // Form types of the items that can be looted. Also used when -1 is given as a form type
+    FormTypeMask _MakeLootableItemTypes()
+    {
+        FormTypeMask formTypes;
+        formTypes.Set(FormType::kFormType_ALCH);
+        formTypes.Set(FormType::kFormType_AMMO);
+        formTypes.Set(FormType::kFormType_ARMO);
+        formTypes.Set(FormType::kFormType_BOOK);
+        formTypes.Set(FormType::kFormType_INGR);
+        formTypes.Set(FormType::kFormType_KEYM);
+        formTypes.Set(FormType::kFormType_MISC);
+        formTypes.Set(FormType::kFormType_WEAP);
+        return formTypes;
+    }
+
+    const FormTypeMask lootableItemTypes = _MakeLootableItemTypes();
+
+    // Compile the form types given by papyrus into a mask. -1 stands for every lootable item type, and the form types after it are ignored
+    FormTypeMask _CompileItemTypes(VMArray<UInt32> &formTypes)
+    {
+        FormTypeMask itemTypes;
+        for(UInt32 i = 0; i < formTypes.Length(); i++)
+        {
+            UInt32 formType;
+            formTypes.Get(&formType, i);
+            if(formType == -1)
+            {
+                itemTypes.Add(lootableItemTypes);
+                break;
+            }
+            if(formType <= 0xFF)
+            {
+                itemTypes.Set((UInt8)formType);
+            }
+        }
+        return itemTypes;
+    }
+
+    // Get and return only items of a specified form type from an inventory of object references
+    VMArray<TESForm *> GetInventoryItemsOfFormTypes(StaticFunctionTag *, TESObjectREFR * ref, VMArray<UInt32> formTypes)
+    {
+#ifdef _DEBUG
+        const char * processId = _GetRandomProcessID();
+        _MESSAGE("| %s | *** GetInventoryItemsOfFormTypes start ***", processId);
+#endif
         VMArray<TESForm *> result;
 
-        auto dataIt = InjectionData::formListData.FindMember(identify);
-        if(dataIt == InjectionData::formListData.MemberEnd() || !dataIt->value.IsArray())
+        if(!ref || formTypes.IsNone())
+        {
+            return result;
+        }
+
+#ifdef _DEBUG
+        _MESSAGE("| %s |   Target: [Name=%s, ID=%08X]", processId, CALL_MEMBER_FN(ref, GetReferenceName)(), ref->formID);
+#endif
+
+        // The array is unpacked once per call instead of once per item
+        FormTypeMask itemTypes = _CompileItemTypes(formTypes);
+        if(itemTypes.IsEmpty())
+        {
+            return result;
+        }
+
+        std::shared_ptr<const InventoryDigestCache::Digest> digest = InventoryDigestCache::Get(ref);
+        if(!digest)
+        {
+            return result;
+        }
+
+        for(const InventoryDigestCache::Item &item : digest->items)
+        {
+#ifdef _DEBUG
+            _TraceTESForm(processId, item.form, 1);
+            _MESSAGE("| %s |       Count: %d, Flags: %s", processId, item.count, _FlagsToBinaryString(item.flags));
+#endif
+            if(!itemTypes.Test(item.form->formType) || (item.flags & InventoryDigestCache::kItemFlag_DroppedWeapon) != 0)
+            {
+                continue;
+            }
+
+            TESForm * form = item.form;
+            result.Push(&form);
+        }
+
+#ifdef _DEBUG
+        _MESSAGE("| %s | *** GetInventoryItemsOfFormTypes end ***", processId);
+#endif
+        return result;
+    }
+
+    VMArray<TESForm *> _GetInventoryItemsOfFormTypesLatent(UInt32 stackId, StaticFunctionTag * base, TESObjectREFR * ref, VMArray<UInt32> formTypes)
+    {
+        return GetInventoryItemsOfFormTypes(base, ref, formTypes);
+    }
+
+    char getInventoryItemsOfFormTypesFunctorName[] = "LootmanGetInventoryItemsOfFormTypesFunctor";
+    typedef F4SEDelayFunctor2<getInventoryItemsOfFormTypesFunctorName, _GetInventoryItemsOfFormTypesLatent, StaticFunctionTag, VMArray<TESForm *>, TESObjectREFR *, VMArray<UInt32>> LootmanGetInventoryItemsOfFormTypesFunctor;
+
+    // Latent version of GetInventoryItemsOfFormTypes
+    bool GetInventoryItemsOfFormTypesLatent(VirtualMachine * vm, UInt32 stackId, StaticFunctionTag * base, TESObjectREFR * ref, VMArray<UInt32> formTypes)
+    {
+        if(!objectInterface || !ref)
+        {
+            return false;
+        }
+
+        objectInterface->GetDelayFunctorManager().Enqueue(new LootmanGetInventoryItemsOfFormTypesFunctor(_GetInventoryItemsOfFormTypesLatent, vm, stackId, base, ref, formTypes));
+        return true;
+    }
+
+    // Get and return the items of the form types in the inventories of several containers in one call, as (container, item, count).
+    // Items are filtered in the same way as GetInventoryItemsOfFormTypes, and the form types are compiled once for all the containers
+    VMArray<InventoryItem> GetInventoryItemsOfFormTypesBatch(StaticFunctionTag *, VMArray<TESObjectREFR *> refs, VMArray<UInt32> formTypes)
+    {
+#ifdef _DEBUG
+        const char * processId = _GetRandomProcessID();
+        _MESSAGE("| %s | *** GetInventoryItemsOfFormTypesBatch start ***", processId);
+#endif
+        VMArray<InventoryItem> result;
+
+        if(refs.IsNone() || formTypes.IsNone())
+        {
+            return result;
+        }
+
+        FormTypeMask itemTypes = _CompileItemTypes(formTypes);
+        if(itemTypes.IsEmpty())
+        {
+            return result;
+        }
+
+        for(UInt32 i = 0; i < refs.Length(); i++)
+        {
+            TESObjectREFR * ref = nullptr;
+            refs.Get(&ref, i);
+            if(!ref)
+            {
+                continue;
+            }
+
+            std::shared_ptr<const InventoryDigestCache::Digest> digest = InventoryDigestCache::Get(ref);
+            if(!digest)
+            {
+                continue;
+            }
+
+#ifdef _DEBUG
+            _MESSAGE("| %s |   Target: [Name=%s, ID=%08X, Items=%d]", processId, CALL_MEMBER_FN(ref, GetReferenceName)(), ref->formID, digest->items.size());
+#endif
+            for(const InventoryDigestCache::Item &item : digest->items)
+            {
+                if(!itemTypes.Test(item.form->formType) || (item.flags & InventoryDigestCache::kItemFlag_DroppedWeapon) != 0)
+                {
+                    continue;
+                }
+
+                TESForm * form = item.form;
+                InventoryItem found;
+                found.Set("container", ref);
+                found.Set("item", form);
+                found.Set("count", (UInt32)(std::max)(item.count, 0));
+                result.Push(&found);
+            }
+        }
+
+#ifdef _DEBUG
+        _MESSAGE("| %s | *** GetInventoryItemsOfFormTypesBatch end ***", processId);
+#endif
+        return result;
+    }
+
+    // Verify the object is a Legendary item. Returns false if the object is not playable, or if it is neither a weapon nor armor
+    bool IsLegendaryItem(StaticFunctionTag *, VMRefOrInventoryObj * ref)
+    {
+        if(!ref)
+        {
+            return false;
+        }
+
+        TESForm * baseForm = nullptr;
+        ExtraDataList * extraDataList = nullptr;
+        ref->GetExtraData(&baseForm, &extraDataList);
+        if(!FormUtil::IsPlayable(baseForm) || (baseForm->formType != FormType::kFormType_WEAP && baseForm->formType != FormType::kFormType_ARMO))
+        {
+            return false;
+        }
+
+        return FormUtil::HasLegendaryMod(extraDataList);
+    }
+
+    // Verify the existence of the specified item's legendary in the object's inventory. Returns false if the item is not playable, or if it is neither a weapon nor armor
+    bool HasLegendaryItem(StaticFunctionTag *, TESObjectREFR * ref, TESForm * form)
+    {
+        if(!ref || !FormUtil::IsPlayable(form) || (form->formType != FormType::kFormType_WEAP && form->formType != FormType::kFormType_ARMO))
+        {
+            return false;
+        }
+
+        BGSInventoryList * inventoryList = ref->inventoryList;
+        if(!inventoryList)
         {
-            return result;
+            return false;
         }
 
-        for (auto it = dataIt->value.Begin(); it != dataIt->value.End(); ++it)
+        // Only the mod IDs of the item's stacks are copied under the lock, the mods are looked up after it is released
+        std::vector<UInt32> modIds;
         {
-            if(!it->IsString())
-            {
-                continue;
-            }
+            BSReadLocker locker(&inventoryList->inventoryLock);
 
-            std::string value = it->GetString();
-            std::string::size_type delimiter = value.find('|');
-            if(delimiter != std::string::npos)
+            for(UInt32 i = 0; i < inventoryList->items.count; i++)
             {
-                std::string modName = value.substr(0, delimiter);
-                const ModInfo * info = (*g_dataHandler)->LookupModByName(modName.c_str());
-                if(!info)
-                {
-                    _WARNING("* Mod is not found [%s]", modName.c_str());
-                    continue;
-                }
+                BGSInventoryItem item;
+                inventoryList->items.GetNthItem(i, item);
 
-                std::string lowerFormId = value.substr(delimiter + 1);
-                UInt32 formId = info->GetFormID(std::stoul(lowerFormId, nullptr, 16));
-                TESForm * form = LookupFormByID(formId);
-                if(!form)
+                TESForm * formInInventory = item.form;
+                if(!formInInventory || formInInventory->formID != form->formID || !item.stack)
                 {
-                    _WARNING("* Form is not found [ModName: %s, LowerFormID: %s, FormID: %08X]", modName.c_str(), lowerFormId.c_str(), formId);
                     continue;
                 }
 
-                result.Push(&form);
+#ifdef _DEBUG
+                _TraceBGSInventoryItem(_GetRandomProcessID(), &item, 0);
+#endif
+
+                item.stack->Visit([&modIds](BGSInventoryItem::Stack * stack) mutable
+                {
+                    FormUtil::CollectModIDs(stack->extraData, modIds);
+                    return true;
+                });
             }
         }
 
+        return !modIds.empty() && FormUtil::HasLegendaryModID(&modIds[0], (UInt32)modIds.size());
+    }
+
+    // Get and return the injection data to be registered in the form list
+    VMArray<TESForm *> GetInjectionDataForList(StaticFunctionTag *, BSFixedString identify)
+    {
+        VMArray<TESForm *> result;
+
+        std::vector<TESForm *> forms;
+        InjectionData::GetForms(identify, forms);
+        for(TESForm * form : forms)
+        {
+            result.Push(&form);
+        }
+
         return result;
     }
 
@@ -461,7 +1416,7 @@ namespace PapyrusLootman
 
     // Verify the object is linked to the workshop
     // Source code used for reference: PapyrusObjectReference#AttachWireLatent
-    bool IsLinkedToWorkshop(StaticFunctionTag *, TESObjectREFR * ref)
+    bool _IsLinkedToWorkshop(TESObjectREFR * ref)
     {
         BGSKeyword * keyword = nullptr;
         BGSDefaultObject * workshopItemDefault = (*g_defaultObjectMap)->GetDefaultObject("WorkshopItem");
@@ -490,6 +1445,50 @@ namespace PapyrusLootman
         return true;
     }
 
+    // Verify the object is linked to the workshop
+    bool IsLinkedToWorkshop(StaticFunctionTag *, TESObjectREFR * ref)
+    {
+        return _IsLinkedToWorkshop(ref);
+    }
+
+    // Get the result of scrapping an object of the base form with the mods. The mod IDs are sorted in place
+    std::shared_ptr<const ScrapResultCache::Components> _GetScrapResult(UInt32 baseFormId, std::vector<UInt32> &modIds)
+    {
+        // Objects of the same base form with the same mods scrap into the same components
+        Scratch::Vector<UInt32> &key = _GetScanScratch().scrapKey;
+        key.Reset();
+        ScrapResultCache::MakeKey(baseFormId, modIds, key);
+
+        std::shared_ptr<const ScrapResultCache::Components> memoized = ScrapResultCache::Get(key);
+        if(memoized)
+        {
+            return memoized;
+        }
+
+        ComponentAccumulator &accumulator = _GetScanScratch().scrapComponents;
+        for(UInt32 modId : modIds)
+        {
+            if(FormUtil::IsMod(modId))
+            {
+                accumulator.Add(ConstructibleObjectIndex::FindComponents(modId), 1);
+            }
+        }
+        accumulator.Add(ConstructibleObjectIndex::FindComponents(baseFormId), 1);
+
+        std::shared_ptr<ScrapResultCache::Components> components = std::make_shared<ScrapResultCache::Components>();
+        accumulator.Take([&components](UInt32 index, UInt32 count)
+        {
+            ScrapResultCache::Component component;
+            component.component = ConstructibleObjectIndex::GetComponent(index);
+            component.index = index;
+            component.count = count / 2;
+            components->push_back(component);
+        });
+
+        ScrapResultCache::Put(key, components);
+        return components;
+    }
+
     // Return the result of scrapping an object
     VMArray<MiscComponent> GetScrapComponents(StaticFunctionTag *, VMRefOrInventoryObj * ref)
     {
@@ -512,95 +1511,446 @@ namespace PapyrusLootman
             return result;
         }
 
-        std::map<BGSComponent *, UInt32> map;
-        auto push = [&map](BGSConstructibleObject * cobj)
+        Scratch::Vector<UInt32> &modIds = _GetScanScratch().stackModIds;
+        modIds.Reset();
+        FormUtil::CollectModIDs(extraDataList, modIds);
+        std::shared_ptr<const ScrapResultCache::Components> components = _GetScrapResult(baseForm->formID, modIds);
+
+        for(const ScrapResultCache::Component &component : *components)
+        {
+            MiscComponent comp;
+            comp.Set("object", component.component);
+            comp.Set("count", component.count);
+            result.Push(&comp);
+        }
+
+        return result;
+    }
+
+    VMArray<MiscComponent> _GetScrapComponentsLatent(UInt32 stackId, StaticFunctionTag * base, VMRefOrInventoryObj * ref)
+    {
+        return GetScrapComponents(base, ref);
+    }
+
+    char getScrapComponentsFunctorName[] = "LootmanGetScrapComponentsFunctor";
+    typedef F4SEDelayFunctor1<getScrapComponentsFunctorName, _GetScrapComponentsLatent, StaticFunctionTag, VMArray<MiscComponent>, VMRefOrInventoryObj *> LootmanGetScrapComponentsFunctor;
+
+    // Latent version of GetScrapComponents
+    bool GetScrapComponentsLatent(VirtualMachine * vm, UInt32 stackId, StaticFunctionTag * base, VMRefOrInventoryObj * ref)
+    {
+        if(!objectInterface || !ref)
+        {
+            return false;
+        }
+
+        objectInterface->GetDelayFunctorManager().Enqueue(new LootmanGetScrapComponentsFunctor(_GetScrapComponentsLatent, vm, stackId, base, ref));
+        return true;
+    }
+
+    // Copy the stacks of the inventory whose form type is in the mask and that can be scrapped, with the mod IDs of weapons and armors.
+    // The stacks are copied in one pass under the lock, so that they are scrapped after it is released
+    void _CopyScrapStacks(BGSInventoryList * inventoryList, const FormTypeMask &itemTypes, Scratch::Vector<ScrapStack> &stacks, Scratch::Vector<UInt32> &modIds)
+    {
+        stacks.Reset();
+        modIds.Reset();
+
+        BSReadLocker locker(&inventoryList->inventoryLock);
+
+        for(UInt32 i = 0; i < inventoryList->items.count; i++)
         {
-            if(!cobj)
+            BGSInventoryItem item;
+            inventoryList->items.GetNthItem(i, item);
+            if(!item.form || !item.stack || !itemTypes.Test(item.form->formType))
             {
-                return;
+                continue;
             }
 
-            for(UInt32 i = 0; i < cobj->components->count; i++)
+            UInt8 formType = item.form->formType;
+            bool isEquipment = formType == FormType::kFormType_WEAP || formType == FormType::kFormType_ARMO;
+            if(!isEquipment && formType != FormType::kFormType_MISC)
             {
-                BGSConstructibleObject::Component cobjComponent;
-                cobj->components->GetNthItem(i, cobjComponent);
+                continue;
+            }
 
-                TESObjectMISC * misc = DYNAMIC_CAST(cobjComponent.component, TESForm, TESObjectMISC);
-                if(misc)
+            item.stack->Visit([&](BGSInventoryItem::Stack * stack) mutable
+            {
+                // Same as the inventory scans, weapons dropped by actors are left alone
+                if(formType == FormType::kFormType_WEAP && (stack->flags & 1 << 5) != 0)
                 {
-                    for(UInt32 j = 0; j < cobjComponent.count; j++)
-                    {
-                        for(UInt32 k = 0; k < misc->components->count; k++)
-                        {
-                            TESObjectMISC::Component miscComponent;
-                            misc->components->GetNthItem(k, miscComponent);
-
-                            map[miscComponent.component] += (UInt32)miscComponent.count;
-                        }
-                    }
+                    return true;
                 }
-                else
+
+                ScrapStack snapshot;
+                snapshot.form = item.form;
+                snapshot.count = stack->count;
+                snapshot.firstModId = (UInt32)modIds.size();
+                if(isEquipment)
                 {
-                    map[cobjComponent.component] += cobjComponent.count;
+                    FormUtil::CollectModIDs(stack->extraData, modIds);
                 }
+                snapshot.modIdCount = (UInt32)modIds.size() - snapshot.firstModId;
+
+                stacks.push_back(snapshot);
+                return true;
+            });
+        }
+    }
+
+    // Add the components of scrapping every object of the stack to the totals
+    void _AddScrapStack(const ScrapStack &stack, const Scratch::Vector<UInt32> &modIds, ComponentAccumulator &totals)
+    {
+        if(stack.count <= 0 || !FormUtil::IsPlayable(stack.form))
+        {
+            return;
+        }
+
+        if(stack.form->formType == FormType::kFormType_MISC)
+        {
+            totals.Add(ConstructibleObjectIndex::FindMiscComponents(stack.form->formID), stack.count);
+            return;
+        }
+
+        // Every object of the stack has the same mods, so the stack is scrapped as one object and multiplied
+        Scratch::Vector<UInt32> &stackModIds = _GetScanScratch().stackModIds;
+        stackModIds.assign(modIds.begin() + stack.firstModId, modIds.begin() + stack.firstModId + stack.modIdCount);
+        std::shared_ptr<const ScrapResultCache::Components> components = _GetScrapResult(stack.form->formID, stackModIds);
+        for(const ScrapResultCache::Component &component : *components)
+        {
+            totals.Add(component.index, component.count * stack.count);
+        }
+    }
+
+    // Return the components of scrapping every stack of the inventory whose form type is in the array, summed by component.
+    // Weapons and armors are scrapped with their mods, and misc objects into their components
+    VMArray<MiscComponent> GetScrapComponentsForInventory(StaticFunctionTag *, TESObjectREFR * ref, VMArray<UInt32> formTypes)
+    {
+        VMArray<MiscComponent> result;
+        if(!ref || formTypes.IsNone())
+        {
+            return result;
+        }
+
+        FormTypeMask itemTypes = _CompileItemTypes(formTypes);
+        if(itemTypes.IsEmpty())
+        {
+            return result;
+        }
+
+        BGSInventoryList * inventoryList = ref->inventoryList;
+        if(!inventoryList)
+        {
+            return result;
+        }
+
+        ScanScratch &scratch = _GetScanScratch();
+        _CopyScrapStacks(inventoryList, itemTypes, scratch.scrapStacks, scratch.scrapModIds);
+
+        ComponentAccumulator &totals = scratch.inventoryScrapComponents;
+        for(const ScrapStack &stack : scratch.scrapStacks)
+        {
+            _AddScrapStack(stack, scratch.scrapModIds, totals);
+        }
+
+        totals.Take([&result](UInt32 index, UInt32 count)
+        {
+            MiscComponent comp;
+            comp.Set("object", ConstructibleObjectIndex::GetComponent(index));
+            comp.Set("count", count);
+            result.Push(&comp);
+        });
+
+        return result;
+    }
+
+    // Not defined by F4SE. The number of objects an item reference stands for, absent when it is one
+    class ExtraCount : public BSExtraData
+    {
+    public:
+        SInt16 count;   // 18
+    };
+
+    // Get the number of objects an item reference stands for
+    UInt32 _GetReferenceCount(TESObjectREFR * ref)
+    {
+        if(!ref->extraDataList)
+        {
+            return 1;
+        }
+
+        ExtraCount * extra = (ExtraCount *)ref->extraDataList->GetByType(ExtraDataType::kExtraData_Count);
+        return extra && extra->count > 1 ? (UInt32)extra->count : 1;
+    }
+
+    // Not defined by F4SE. The life state of an actor is the bit field after the move mode (14 bits) and the fly state (3 bits)
+    // in the first field of ActorState. The second field holds the weapon state that F4SE reads, laid out in the same way
+    enum
+    {
+        kLifeStateShift = 17,
+        kLifeStateMask  = 0x0F,
+
+        kLifeState_Dying    = 1,
+        kLifeState_Dead     = 2
+    };
+
+    STATIC_ASSERT(offsetof(Actor, actorState) == 0x128);
+
+    // Verify that the actor is dying or dead
+    bool _IsDead(Actor * actor)
+    {
+        UInt32 lifeState = (actor->actorState.unk08 >> kLifeStateShift) & kLifeStateMask;
+        return lifeState == kLifeState_Dying || lifeState == kLifeState_Dead;
+    }
+
+    // Get the flags of LootPlanner that follow from the form type of an item
+    UInt32 _GetPlannedItemFlags(UInt8 formType)
+    {
+        if(formType == FormType::kFormType_WEAP || formType == FormType::kFormType_ARMO)
+        {
+            return LootPlanner::kItemFlag_Equipment;
+        }
+        return formType == FormType::kFormType_MISC ? (UInt32)LootPlanner::kItemFlag_Junk : 0;
+    }
+
+    // The game as the world of LootPlanner. Sources are the references found by the scan, items and components are forms
+    class GameLootWorld
+    {
+    public:
+        explicit GameLootWorld(bool applyExclusions) : applyExclusions(applyExclusions)
+        {
+        }
+
+        bool IsDead(const LootPlanner::Source &source)
+        {
+            Actor * actor = DYNAMIC_CAST((TESObjectREFR *)source.ref, TESObjectREFR, Actor);
+            return actor && _IsDead(actor);
+        }
+
+        bool IsLinkedToWorkshop(const LootPlanner::Source &source)
+        {
+            return _IsLinkedToWorkshop((TESObjectREFR *)source.ref);
+        }
+
+        void GetItem(const LootPlanner::Source &source, LootPlanner::Item &item)
+        {
+            TESObjectREFR * ref = (TESObjectREFR *)source.ref;
+            item.form = ref->baseForm;
+            item.formType = ref->baseForm->formType;
+            item.count = _GetReferenceCount(ref);
+            item.flags = _GetPlannedItemFlags(item.formType);
+            if((item.flags & LootPlanner::kItemFlag_Equipment) != 0 && FormUtil::HasLegendaryMod(ref->extraDataList))
+            {
+                item.flags |= LootPlanner::kItemFlag_Legendary;
             }
-        };
+        }
 
-        tArray<BGSConstructibleObject *> cobjList = (*g_dataHandler)->arrCOBJ;
-        auto find = [&cobjList](TESForm * form)
+        // The items are read from the digest, which is built and cached by InventoryDigestCache
+        void GetItems(const LootPlanner::Source &source, std::vector<LootPlanner::Item> &items)
         {
-            for(UInt32 i = 0; i < cobjList.count; i++)
+            std::shared_ptr<const InventoryDigestCache::Digest> digest = InventoryDigestCache::Get((TESObjectREFR *)source.ref);
+            if(!digest)
+            {
+                return;
+            }
+
+            for(const InventoryDigestCache::Item &element : digest->items)
             {
-                BGSConstructibleObject * cobj = nullptr;
-                cobjList.GetNthItem(i, cobj);
+                LootPlanner::Item item;
+                item.form = element.form;
+                item.formType = element.form->formType;
+                item.count = element.count;
+                item.flags = _GetPlannedItemFlags(item.formType);
+                if((element.flags & InventoryDigestCache::kItemFlag_DroppedWeapon) != 0)
+                {
+                    item.flags |= LootPlanner::kItemFlag_DroppedWeapon;
+                }
+                if((element.flags & InventoryDigestCache::kItemFlag_Legendary) != 0)
+                {
+                    item.flags |= LootPlanner::kItemFlag_Legendary;
+                }
 
-                if(!cobj || !cobj->createdObject || !cobj->components)
+                // The scan only excludes the sources, the items in them are excluded by their base forms
+                if(applyExclusions && (FormClassCache::Get(element.form) & FormClassCache::kClass_Excluded) != 0)
                 {
-                    continue;
+                    item.flags |= LootPlanner::kItemFlag_Excluded;
                 }
+                items.push_back(item);
+            }
+        }
 
-                if(form->formID == cobj->createdObject->formID)
+        // Scrap in the same way as GetScrapComponents for an item reference, and as GetScrapComponentsForInventory
+        // restricted to the form of each item for an inventory
+        void Scrap(const LootPlanner::Source &source, std::vector<LootPlanner::Item> &items, std::vector<LootPlanner::Component> &components)
+        {
+            TESObjectREFR * ref = (TESObjectREFR *)source.ref;
+            ScanScratch &scratch = _GetScanScratch();
+            Scratch::Vector<ScrapStack> &stacks = scratch.scrapStacks;
+            Scratch::Vector<UInt32> &modIds = scratch.scrapModIds;
+            if(source.kind == LootPlanner::kSource_Item)
+            {
+                // An item reference is a single stack
+                stacks.Reset();
+                modIds.Reset();
+
+                ScrapStack stack;
+                stack.form = ref->baseForm;
+                stack.count = items[0].count;
+                stack.firstModId = 0;
+                if((items[0].flags & LootPlanner::kItemFlag_Equipment) != 0 && ref->extraDataList)
+                {
+                    FormUtil::CollectModIDs(ref->extraDataList, modIds);
+                }
+                stack.modIdCount = (UInt32)modIds.size();
+                stacks.push_back(stack);
+            }
+            else
+            {
+                if(!ref->inventoryList)
                 {
-                    return cobj;
+                    return;
                 }
 
-                BGSListForm * formList = DYNAMIC_CAST(cobj->createdObject, TESForm, BGSListForm);
-                if(formList)
+                FormTypeMask scrapTypes;
+                for(const LootPlanner::Item &item : items)
                 {
-                    for(UInt32 j = 0; j < formList->forms.count; j++)
+                    if((item.flags & LootPlanner::kItemFlag_Scrap) != 0)
                     {
-                        TESForm * item = nullptr;
-                        formList->forms.GetNthItem(j, item);
+                        scrapTypes.Set(item.formType);
+                    }
+                }
+                _CopyScrapStacks(ref->inventoryList, scrapTypes, stacks, modIds);
+            }
+
+            ComponentAccumulator &totals = scratch.inventoryScrapComponents;
+            for(LootPlanner::Item &item : items)
+            {
+                if((item.flags & LootPlanner::kItemFlag_Scrap) == 0)
+                {
+                    continue;
+                }
 
-                        if(item && form->formID == item->formID)
-                        {
-                            return cobj;
-                        }
+                for(const ScrapStack &stack : stacks)
+                {
+                    if(stack.form == item.form)
+                    {
+                        _AddScrapStack(stack, modIds, totals);
                     }
                 }
+
+                item.firstComponent = (UInt32)components.size();
+                totals.Take([&components](UInt32 index, UInt32 count)
+                {
+                    if(count > 0)
+                    {
+                        LootPlanner::Component component;
+                        component.form = (TESForm *)ConstructibleObjectIndex::GetComponent(index);
+                        component.count = count;
+                        components.push_back(component);
+                    }
+                });
+                item.componentCount = (UInt32)components.size() - item.firstComponent;
             }
-            return (BGSConstructibleObject *)nullptr;
-        };
+        }
+
+    private:
+        bool applyExclusions;
+    };
+
+    // Plan the loot within the range of the player in one call, and return the actions in the order to execute: closest source first.
+    // Item references are planned as a pick-up of the reference, containers and corpses as a transfer of each item, and scrapped items
+    // are followed by their components. The form types select the items to loot, with -1 meaning every lootable item type.
+    // Options are the kLootPlan_* flags of LootPlanner
+    VMArray<LootAction> BuildLootPlan(StaticFunctionTag *, TESObjectREFR * player, UInt32 range, VMArray<UInt32> formTypes, UInt32 options, UInt32 maxActions)
+    {
+#ifdef _DEBUG
+        const char * processId = _GetRandomProcessID();
+        _MESSAGE("| %s | *** BuildLootPlan start ***", processId);
+#endif
+        VMArray<LootAction> result;
+
+        if(!player || formTypes.IsNone() || maxActions == 0)
+        {
+            return result;
+        }
+
+        FormTypeMask itemTypes;
+        for(UInt32 i = 0; i < formTypes.Length(); i++)
+        {
+            UInt32 formType;
+            formTypes.Get(&formType, i);
+            if(formType == -1)
+            {
+                itemTypes = lootableItemTypes;
+                break;
+            }
+            if(formType <= 0xFF && lootableItemTypes.Test((UInt8)formType))
+            {
+                itemTypes.Set((UInt8)formType);
+            }
+        }
 
-        VMArray<BGSMod::Attachment::Mod *> mods = _GetAllMods(extraDataList);
-        for(UInt32 i = 0; i < mods.Length(); i++)
+        if(itemTypes.IsEmpty())
         {
-            BGSMod::Attachment::Mod * objectMod = nullptr;
-            mods.Get(&objectMod, i);
+            return result;
+        }
 
-            push(find(objectMod));
+        FormTypeMask sourceTypes = itemTypes;
+        if((options & LootPlanner::kLootPlan_Containers) != 0)
+        {
+            sourceTypes.Set(FormType::kFormType_CONT);
+        }
+        if((options & LootPlanner::kLootPlan_Corpses) != 0)
+        {
+            sourceTypes.Set(FormType::kFormType_NPC_);
         }
 
-        push(find(baseForm));
+        ScanScratch &scratch = _GetScanScratch();
+        Scratch::Vector<ObjectReferenceWithDistance> &foundObjects = scratch.foundObjects;
+        foundObjects.Reset();
+        _FindReferences(player, range, sourceTypes, (options & LootPlanner::kLootPlan_ApplyExclusions) != 0, foundObjects);
 
-        for(auto const &it : map)
+        Scratch::Vector<LootPlanner::Source> &sources = scratch.planSources;
+        sources.Reset();
+        for(const ObjectReferenceWithDistance &element : foundObjects)
         {
-            MiscComponent comp;
-            comp.Set("object", it.first);
-            comp.Set("count", (UInt32)(it.second / 2));
-            result.Push(&comp);
+            LootPlanner::Source source;
+            source.ref = element.ref;
+            source.distance = element.distance;
+            if(element.formType == FormType::kFormType_CONT)
+            {
+                source.kind = LootPlanner::kSource_Container;
+            }
+            else if(element.formType == FormType::kFormType_NPC_)
+            {
+                source.kind = LootPlanner::kSource_Actor;
+            }
+            else
+            {
+                source.kind = LootPlanner::kSource_Item;
+            }
+            sources.push_back(source);
         }
 
+        Scratch::Vector<LootPlanner::Action> &actions = scratch.planActions;
+        actions.Reset();
+        GameLootWorld world((options & LootPlanner::kLootPlan_ApplyExclusions) != 0);
+        LootPlanner::Plan(world, player, sources, itemTypes, options, maxActions, scratch.planWorkspace, actions);
+
+        for(const LootPlanner::Action &planned : actions)
+        {
+            TESObjectREFR * source = (TESObjectREFR *)planned.source;
+            TESForm * item = (TESForm *)planned.item;
+            LootAction action;
+            action.Set("source", source);
+            action.Set("item", item);
+            action.Set("count", planned.count);
+            action.Set("flags", planned.flags);
+            result.Push(&action);
+        }
+
+#ifdef _DEBUG
+        _MESSAGE("| %s |   Planned actions: %d", processId, result.Length());
+        _MESSAGE("| %s | *** BuildLootPlan end ***", processId);
+#endif
         return result;
     }
 
@@ -629,6 +1979,37 @@ namespace PapyrusLootman
         return ss.str().c_str();
     }
 
+    // Get and return the statistics of the cells tracked by the form ID cache
+    BSFixedString GetCellCacheStats(StaticFunctionTag *)
+    {
+        SimpleLocker locker(&FormIDCache::lock);
+        std::stringstream ss;
+        ss << "Live cells: " << FormIDCache::cells.size() << ", Detached cells: " << FormIDCache::detachedCells << ", Evicted cells: " << FormIDCache::evictedCells << ", Indexed references: " << FormIDCache::references.Size();
+        return ss.str().c_str();
+    }
+
+    // Get and return the number of scrap results answered from the cache and computed
+    BSFixedString GetScrapCacheStats(StaticFunctionTag *)
+    {
+        std::stringstream ss;
+        ss << "Hits: " << ScrapResultCache::hits << ", Misses: " << ScrapResultCache::misses;
+        return ss.str().c_str();
+    }
+
+    // Get and return the number of inventory digests built and reused
+    BSFixedString GetInventoryDigestStats(StaticFunctionTag *)
+    {
+        std::stringstream ss;
+        ss << "Builds: " << InventoryDigestCache::builds << ", Hits: " << InventoryDigestCache::hits;
+        return ss.str().c_str();
+    }
+
+    // Get and return the number of allocations made by the scratch buffers of the scans
+    UInt32 GetScratchAllocations(StaticFunctionTag *)
+    {
+        return Scratch::allocations;
+    }
+
     // Get and return the form's identify
     BSFixedString GetIdentify(StaticFunctionTag *, TESForm * form)
     {
@@ -642,35 +2023,88 @@ namespace PapyrusLootman
 #endif
 }
 
+bool PapyrusLootman::SetObjectInterface(F4SEObjectInterface * object)
+{
+    objectInterface = object;
+
+    // Registered so that the functors still pending when the game is saved can be restored
+    F4SEObjectRegistry &registry = object->GetObjectRegistry();
+    if(!registry.RegisterClass<LootmanFindAllReferencesOfFormTypeFunctor>() ||
+       !registry.RegisterClass<LootmanGetInventoryItemsOfFormTypesFunctor>() ||
+       !registry.RegisterClass<LootmanGetScrapComponentsFunctor>())
+    {
+        objectInterface = nullptr;
+        return false;
+    }
+    return true;
+}
+
 bool PapyrusLootman::RegisterFuncs(VirtualMachine* vm)
 {
     _MESSAGE(">> Lootman papyrus functions register phase start.");
 
     vm->RegisterFunction(new NativeFunction3<StaticFunctionTag, VMArray<TESObjectREFR *>, TESObjectREFR *, UInt32, UInt32>("FindAllReferencesOfFormType", "Lootman", PapyrusLootman::FindAllReferencesOfFormType, vm));
+    vm->RegisterFunction(new LatentNativeFunction3<StaticFunctionTag, VMArray<TESObjectREFR *>, TESObjectREFR *, UInt32, UInt32>("FindAllReferencesOfFormTypeLatent", "Lootman", PapyrusLootman::FindAllReferencesOfFormTypeLatent, vm));
+    vm->RegisterFunction(new NativeFunction5<StaticFunctionTag, VMArray<TESObjectREFR *>, TESObjectREFR *, UInt32, UInt32, UInt32, bool>("FindNearestReferencesOfFormType", "Lootman", PapyrusLootman::FindNearestReferencesOfFormType, vm));
+    vm->RegisterFunction(new NativeFunction4<StaticFunctionTag, VMArray<FoundReference>, TESObjectREFR *, UInt32, VMArray<UInt32>, bool>("FindAllReferencesOfFormTypes", "Lootman", PapyrusLootman::FindAllReferencesOfFormTypes, vm));
+    vm->RegisterFunction(new NativeFunction0<StaticFunctionTag, UInt32>("OpenScanCursor", "Lootman", PapyrusLootman::OpenScanCursor, vm));
+    vm->RegisterFunction(new NativeFunction1<StaticFunctionTag, void, UInt32>("CloseScanCursor", "Lootman", PapyrusLootman::CloseScanCursor, vm));
+    vm->RegisterFunction(new NativeFunction5<StaticFunctionTag, VMArray<TESObjectREFR *>, UInt32, TESObjectREFR *, UInt32, UInt32, bool>("FindReferencesSince", "Lootman", PapyrusLootman::FindReferencesSince, vm));
+    vm->RegisterFunction(new NativeFunction4<StaticFunctionTag, UInt32, TESObjectREFR *, UInt32, VMArray<UInt32>, bool>("StartBudgetedScan", "Lootman", PapyrusLootman::StartBudgetedScan, vm));
+    vm->RegisterFunction(new NativeFunction2<StaticFunctionTag, bool, UInt32, UInt32>("ContinueBudgetedScan", "Lootman", PapyrusLootman::ContinueBudgetedScan, vm));
+    vm->RegisterFunction(new NativeFunction1<StaticFunctionTag, VMArray<FoundReference>, UInt32>("FinishBudgetedScan", "Lootman", PapyrusLootman::FinishBudgetedScan, vm));
+    vm->RegisterFunction(new NativeFunction0<StaticFunctionTag, BSFixedString>("GetBudgetedScanStats", "Lootman", PapyrusLootman::GetBudgetedScanStats, vm));
+    vm->RegisterFunction(new NativeFunction4<StaticFunctionTag, void, bool, UInt32, UInt32, UInt32>("ConfigurePreScan", "Lootman", PapyrusLootman::ConfigurePreScan, vm));
     vm->RegisterFunction(new NativeFunction1<StaticFunctionTag, UInt32, TESForm *>("GetFormType", "Lootman", PapyrusLootman::GetFormType, vm));
     vm->RegisterFunction(new NativeFunction1<StaticFunctionTag, VMArray<TESForm *>, BSFixedString>("GetInjectionDataForList", "Lootman", PapyrusLootman::GetInjectionDataForList, vm));
     vm->RegisterFunction(new NativeFunction2<StaticFunctionTag, VMArray<TESForm *>, TESObjectREFR *, VMArray<UInt32>>("GetInventoryItemsOfFormTypes", "Lootman", PapyrusLootman::GetInventoryItemsOfFormTypes, vm));
+    vm->RegisterFunction(new NativeFunction2<StaticFunctionTag, VMArray<InventoryItem>, VMArray<TESObjectREFR *>, VMArray<UInt32>>("GetInventoryItemsOfFormTypesBatch", "Lootman", PapyrusLootman::GetInventoryItemsOfFormTypesBatch, vm));
+    vm->RegisterFunction(new LatentNativeFunction2<StaticFunctionTag, VMArray<TESForm *>, TESObjectREFR *, VMArray<UInt32>>("GetInventoryItemsOfFormTypesLatent", "Lootman", PapyrusLootman::GetInventoryItemsOfFormTypesLatent, vm));
     vm->RegisterFunction(new NativeFunction2<StaticFunctionTag, bool, TESObjectREFR *, TESForm *>("HasLegendaryItem", "Lootman", PapyrusLootman::HasLegendaryItem, vm));
     vm->RegisterFunction(new NativeFunction1<StaticFunctionTag, bool, VMRefOrInventoryObj *>("IsLegendaryItem", "Lootman", PapyrusLootman::IsLegendaryItem, vm));
     vm->RegisterFunction(new NativeFunction1<StaticFunctionTag, bool, TESObjectREFR *>("IsLinkedToWorkshop", "Lootman", PapyrusLootman::IsLinkedToWorkshop, vm));
     vm->RegisterFunction(new NativeFunction1<StaticFunctionTag, VMArray<MiscComponent>, VMRefOrInventoryObj *>("GetScrapComponents", "Lootman", PapyrusLootman::GetScrapComponents, vm));
+    vm->RegisterFunction(new LatentNativeFunction1<StaticFunctionTag, VMArray<MiscComponent>, VMRefOrInventoryObj *>("GetScrapComponentsLatent", "Lootman", PapyrusLootman::GetScrapComponentsLatent, vm));
+    vm->RegisterFunction(new NativeFunction2<StaticFunctionTag, VMArray<MiscComponent>, TESObjectREFR *, VMArray<UInt32>>("GetScrapComponentsForInventory", "Lootman", PapyrusLootman::GetScrapComponentsForInventory, vm));
+    vm->RegisterFunction(new NativeFunction5<StaticFunctionTag, VMArray<LootAction>, TESObjectREFR *, UInt32, VMArray<UInt32>, UInt32, UInt32>("BuildLootPlan", "Lootman", PapyrusLootman::BuildLootPlan, vm));
 
     //vm->SetFunctionFlags("Lootman", "FindAllReferencesOfFormType", IFunction::kFunctionFlag_NoWait);
+    //vm->SetFunctionFlags("Lootman", "FindNearestReferencesOfFormType", IFunction::kFunctionFlag_NoWait);
+    //vm->SetFunctionFlags("Lootman", "FindAllReferencesOfFormTypes", IFunction::kFunctionFlag_NoWait);
+    vm->SetFunctionFlags("Lootman", "OpenScanCursor", IFunction::kFunctionFlag_NoWait);
+    vm->SetFunctionFlags("Lootman", "CloseScanCursor", IFunction::kFunctionFlag_NoWait);
+    //vm->SetFunctionFlags("Lootman", "FindReferencesSince", IFunction::kFunctionFlag_NoWait);
+    //vm->SetFunctionFlags("Lootman", "StartBudgetedScan", IFunction::kFunctionFlag_NoWait);
+    //vm->SetFunctionFlags("Lootman", "ContinueBudgetedScan", IFunction::kFunctionFlag_NoWait);
+    //vm->SetFunctionFlags("Lootman", "FinishBudgetedScan", IFunction::kFunctionFlag_NoWait);
+    vm->SetFunctionFlags("Lootman", "GetBudgetedScanStats", IFunction::kFunctionFlag_NoWait);
+    vm->SetFunctionFlags("Lootman", "ConfigurePreScan", IFunction::kFunctionFlag_NoWait);
     vm->SetFunctionFlags("Lootman", "GetFormType", IFunction::kFunctionFlag_NoWait);
     vm->SetFunctionFlags("Lootman", "GetInjectionDataForList", IFunction::kFunctionFlag_NoWait);
     //vm->SetFunctionFlags("Lootman", "GetInventoryItemsOfFormTypes", IFunction::kFunctionFlag_NoWait);
+    //vm->SetFunctionFlags("Lootman", "GetInventoryItemsOfFormTypesBatch", IFunction::kFunctionFlag_NoWait);
     //vm->SetFunctionFlags("Lootman", "HasLegendaryItem", IFunction::kFunctionFlag_NoWait);
     //vm->SetFunctionFlags("Lootman", "IsLegendaryItem", IFunction::kFunctionFlag_NoWait);
     //vm->SetFunctionFlags("Lootman", "IsLinkedToWorkshop", IFunction::kFunctionFlag_NoWait);
     //vm->SetFunctionFlags("Lootman", "GetScrapComponents", IFunction::kFunctionFlag_NoWait);
+    //vm->SetFunctionFlags("Lootman", "GetScrapComponentsForInventory", IFunction::kFunctionFlag_NoWait);
+    //vm->SetFunctionFlags("Lootman", "BuildLootPlan", IFunction::kFunctionFlag_NoWait);
 
 #ifdef _DEBUG
+    vm->RegisterFunction(new NativeFunction0<StaticFunctionTag, BSFixedString>("GetCellCacheStats", "Lootman", PapyrusLootman::GetCellCacheStats, vm));
     vm->RegisterFunction(new NativeFunction1<StaticFunctionTag, BSFixedString, TESForm *>("GetHexID", "Lootman", PapyrusLootman::GetHexID, vm));
+    vm->RegisterFunction(new NativeFunction0<StaticFunctionTag, BSFixedString>("GetScrapCacheStats", "Lootman", PapyrusLootman::GetScrapCacheStats, vm));
+    vm->RegisterFunction(new NativeFunction0<StaticFunctionTag, BSFixedString>("GetInventoryDigestStats", "Lootman", PapyrusLootman::GetInventoryDigestStats, vm));
+    vm->RegisterFunction(new NativeFunction0<StaticFunctionTag, UInt32>("GetScratchAllocations", "Lootman", PapyrusLootman::GetScratchAllocations, vm));
     vm->RegisterFunction(new NativeFunction1<StaticFunctionTag, BSFixedString, TESForm *>("GetIdentify", "Lootman", PapyrusLootman::GetIdentify, vm));
     vm->RegisterFunction(new NativeFunction0<StaticFunctionTag, BSFixedString>("GetMilliseconds", "Lootman", PapyrusLootman::GetMilliseconds, vm));
     vm->RegisterFunction(new NativeFunction0<StaticFunctionTag, BSFixedString>("GetRandomProcessID", "Lootman", PapyrusLootman::GetRandomProcessID, vm));
 
+    vm->SetFunctionFlags("Lootman", "GetCellCacheStats", IFunction::kFunctionFlag_NoWait);
     vm->SetFunctionFlags("Lootman", "GetHexID", IFunction::kFunctionFlag_NoWait);
+    vm->SetFunctionFlags("Lootman", "GetScrapCacheStats", IFunction::kFunctionFlag_NoWait);
+    vm->SetFunctionFlags("Lootman", "GetInventoryDigestStats", IFunction::kFunctionFlag_NoWait);
+    vm->SetFunctionFlags("Lootman", "GetScratchAllocations", IFunction::kFunctionFlag_NoWait);
     vm->SetFunctionFlags("Lootman", "GetIdentify", IFunction::kFunctionFlag_NoWait);
     vm->SetFunctionFlags("Lootman", "GetMilliseconds", IFunction::kFunctionFlag_NoWait);
     vm->SetFunctionFlags("Lootman", "GetRandomProcessID", IFunction::kFunctionFlag_NoWait);
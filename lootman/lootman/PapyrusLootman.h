@@ -1,8 +1,19 @@
 ﻿#pragma once
 
 class VirtualMachine;
+struct F4SEObjectInterface;
 
 namespace PapyrusLootman
 {
     bool RegisterFuncs(VirtualMachine * vm);
+
+    // Give the object interface the latent functions are queued through, and register their functors. Called before RegisterFuncs.
+    // Returns false if a functor cannot be registered, in which case the latent functions fail
+    bool SetObjectInterface(F4SEObjectInterface * object);
+
+    // Discard the state of every scan cursor. Called before a save is loaded
+    void ClearScanCursors();
+
+    // Discard every budgeted scan. Called before a save is loaded
+    void ClearBudgetedScans();
 }
@@ -0,0 +1,224 @@
+#include "PreScanWorker.h"
+
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <mutex>
+#include <thread>
+
+namespace PreScanWorker
+{
+    // Interval between the checks of the worker in milliseconds
+    const UInt32 kPollInterval = 50;
+
+    std::atomic<bool> enabled(false);
+    std::atomic<bool> stopping(false);
+    std::atomic<UInt32> scanRange(0);
+    std::atomic<UInt32> maxResultAge(0);
+    std::atomic<UInt32> maxResultDisplacement(0);
+
+    SnapshotSource snapshotSource = nullptr;
+    FormTypeMask listedFormTypes;
+
+    // Advances every time the lists are discarded, so that a build running across a clear is not published
+    std::atomic<UInt32> clearCount(0);
+
+    // The origin of the latest scan, handed over to the worker
+    struct Origin
+    {
+        UInt32 spaceId;
+        float x;
+        float y;
+        float z;
+    };
+
+    std::mutex originLock;
+    Origin requestedOrigin;
+    bool hasRequestedOrigin = false;
+
+    // The front buffer read by the scans. The worker builds into the back buffer and swaps them
+    std::shared_ptr<const Result> front;
+
+    // The thread is detached, so that no joinable std::thread is left for the static destructors when the DLL is unloaded.
+    // The process ends the thread on exit, and Shutdown waits for it through this flag
+    std::mutex threadLock;
+    std::atomic<bool> running(false);
+
+    UInt32 _Now()
+    {
+        return (UInt32)std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    float _GetDistance(const Result &result, float x, float y, float z)
+    {
+        float dx = result.x - x;
+        float dy = result.y - y;
+        float dz = result.z - z;
+        return std::sqrt((dx * dx) + (dy * dy) + (dz * dz));
+    }
+
+    void _Loop()
+    {
+        std::shared_ptr<Result> back;
+        std::shared_ptr<const SpatialIndex::Snapshot> builtSnapshot;
+        std::vector<UInt32> hits;
+
+        while(!stopping)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(kPollInterval));
+            if(!enabled || !snapshotSource)
+            {
+                continue;
+            }
+
+            Origin origin;
+            {
+                std::lock_guard<std::mutex> locker(originLock);
+                if(!hasRequestedOrigin)
+                {
+                    continue;
+                }
+                origin = requestedOrigin;
+            }
+
+            std::shared_ptr<const SpatialIndex::Snapshot> snapshot = snapshotSource();
+            UInt32 range = scanRange;
+            UInt32 maxAge = maxResultAge;
+            UInt32 maxDisplacement = maxResultDisplacement;
+
+            // Rebuild at half of the staleness bounds, so that the scans keep finding a fresh list while the next one is built
+            std::shared_ptr<const Result> current = std::atomic_load(&front);
+            if(current && snapshot == builtSnapshot && current->spaceId == origin.spaceId &&
+               _Now() - current->builtAt < maxAge / 2 &&
+               _GetDistance(*current, origin.x, origin.y, origin.z) < maxDisplacement / 2.0f)
+            {
+                continue;
+            }
+
+            // Reuse the back buffer unless a scan is still reading it
+            if(!back || !back.unique())
+            {
+                back = std::make_shared<Result>();
+            }
+
+            UInt32 clearCountAtBuild = clearCount;
+            back->spaceId = origin.spaceId;
+            back->x = origin.x;
+            back->y = origin.y;
+            back->z = origin.z;
+            back->radius = (float)(range + maxDisplacement);
+            back->references.clear();
+
+            // Padded in the same way as the scans, which check the live positions of what is listed
+            UInt32 rejectFlags = SpatialIndex::kEntryFlag_NotPlayable | SpatialIndex::kEntryFlag_NativeObject;
+            std::vector<Reference> &references = back->references;
+            listedFormTypes.ForEach([&](UInt8 formType)
+            {
+                snapshot->Query(origin.spaceId, origin.x, origin.y, origin.z, back->radius + SpatialIndex::kPositionSlack, formType, rejectFlags, hits,
+                                [&references](const SpatialIndex::Entry &entry)
+                {
+                    Reference reference;
+                    reference.formId = entry.formId;
+                    reference.flags = entry.flags;
+                    reference.x = entry.x;
+                    reference.y = entry.y;
+                    reference.z = entry.z;
+                    references.push_back(reference);
+                });
+            });
+            back->builtAt = _Now();
+
+            if(clearCountAtBuild != clearCount)
+            {
+                continue;
+            }
+
+            std::shared_ptr<const Result> previous = std::atomic_exchange(&front, std::shared_ptr<const Result>(back));
+            back = std::const_pointer_cast<Result>(previous);
+            builtSnapshot = snapshot;
+        }
+    }
+
+    void _Run()
+    {
+        _Loop();
+        running = false;
+    }
+
+    void SetSource(SnapshotSource source, const FormTypeMask &formTypes)
+    {
+        snapshotSource = source;
+        listedFormTypes = formTypes;
+    }
+
+    void Configure(bool enable, UInt32 range, UInt32 maxAge, UInt32 maxDisplacement)
+    {
+        scanRange = range;
+        maxResultAge = maxAge;
+        maxResultDisplacement = maxDisplacement;
+        Clear();
+        enabled = enable;
+
+        // The thread lives until the game exits and idles while the worker is disabled
+        std::lock_guard<std::mutex> locker(threadLock);
+        if(enable && !running)
+        {
+            stopping = false;
+            running = true;
+            std::thread(_Run).detach();
+        }
+    }
+
+    std::shared_ptr<const Result> GetResult(UInt32 spaceId, float x, float y, float z, UInt32 range)
+    {
+        if(!enabled)
+        {
+            return nullptr;
+        }
+
+        {
+            std::lock_guard<std::mutex> locker(originLock);
+            requestedOrigin.spaceId = spaceId;
+            requestedOrigin.x = x;
+            requestedOrigin.y = y;
+            requestedOrigin.z = z;
+            hasRequestedOrigin = true;
+        }
+
+        std::shared_ptr<const Result> result = std::atomic_load(&front);
+        if(!result || result->spaceId != spaceId)
+        {
+            return nullptr;
+        }
+
+        // Every reference within the range of the origin is within the range plus the displacement of the list's origin
+        float displacement = _GetDistance(*result, x, y, z);
+        if(_Now() - result->builtAt > maxResultAge || displacement > maxResultDisplacement || range + displacement > result->radius)
+        {
+            return nullptr;
+        }
+
+        return result;
+    }
+
+    void Clear()
+    {
+        clearCount++;
+        std::atomic_store(&front, std::shared_ptr<const Result>());
+
+        std::lock_guard<std::mutex> locker(originLock);
+        hasRequestedOrigin = false;
+    }
+
+    void Shutdown()
+    {
+        enabled = false;
+        stopping = true;
+
+        std::lock_guard<std::mutex> locker(threadLock);
+        while(running)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(kPollInterval));
+        }
+    }
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+
+#include "FormTypeMask.h"
+#include "SpatialIndex.h"
+
+// A native worker that keeps a list of the indexed references around the player, so that the scans requested by papyrus
+// can skip the query of the spatial index. Disabled until papyrus configures it.
+// The worker only reads the published snapshots of the index and the origin handed over by the scans, never a game object,
+// so it does not race with the main thread loading and unloading cells. The scans check every reference it lists on their own thread.
+namespace PreScanWorker
+{
+    // Get the latest snapshot of the index. Called by the worker thread
+    typedef std::shared_ptr<const SpatialIndex::Snapshot> (* SnapshotSource)();
+
+    // A reference as it was indexed
+    struct Reference
+    {
+        UInt32 formId;
+        UInt32 flags;
+        float x;
+        float y;
+        float z;
+
+        // Verify that the reference may be within the range of the origin. The position may have changed since it was indexed
+        bool MayBeWithin(float originX, float originY, float originZ, float range) const
+        {
+            if((flags & SpatialIndex::kEntryFlag_Movable) != 0)
+            {
+                return true;
+            }
+
+            float dx = x - originX;
+            float dy = y - originY;
+            float dz = z - originZ;
+            float radius = range + SpatialIndex::kPositionSlack;
+            return (dx * dx) + (dy * dy) + (dz * dz) <= radius * radius;
+        }
+    };
+
+    // References indexed around a point at a point in time
+    struct Result
+    {
+        UInt32 spaceId;
+        float x;
+        float y;
+        float z;
+        float radius;
+        UInt32 builtAt;             // Milliseconds on the clock of the worker
+        std::vector<Reference> references;
+    };
+
+    // Give the worker where to get the snapshots from, and the form types to list. Called before the worker is configured
+    void SetSource(SnapshotSource source, const FormTypeMask &formTypes);
+
+    // Start or stop the worker. Scans up to the range are answered from a list that is at most maxAge milliseconds
+    // old and built within maxDisplacement units of the scanning position
+    void Configure(bool enable, UInt32 range, UInt32 maxAge, UInt32 maxDisplacement);
+
+    // Get the latest list if it is fresh enough to answer a scan of the range from the origin, otherwise null.
+    // The origin is handed over to the worker, which builds the next list around it
+    std::shared_ptr<const Result> GetResult(UInt32 spaceId, float x, float y, float z, UInt32 range);
+
+    // Discard the lists. Form IDs of created references are reused after loading a save
+    void Clear();
+
+    // Stop the worker thread and wait for it to leave its loop. The game does not need to call it, the thread is ended with the process
+    void Shutdown();
+}
@@ -0,0 +1,93 @@
+#include "ScrapResultCache.h"
+
+#include <algorithm>
+#include <list>
+#include <unordered_map>
+
+#include "f4se/GameTypes.h"
+
+namespace ScrapResultCache
+{
+    // Maximum number of results kept
+    const UInt32 kMaxResults = 512;
+
+    struct KeyHash
+    {
+        size_t operator()(const Key &key) const
+        {
+            // FNV-1a over the IDs
+            size_t hash = 2166136261U;
+            for(UInt32 id : key)
+            {
+                hash = (hash ^ id) * 16777619U;
+            }
+            return hash;
+        }
+    };
+
+    typedef std::pair<Key, std::shared_ptr<const Components>> Result;
+
+    SimpleLock lock;
+
+    // Most recently used first
+    std::list<Result> results;
+    std::unordered_map<Key, std::list<Result>::iterator, KeyHash> resultByKey;
+
+    UInt32 hits = 0;
+    UInt32 misses = 0;
+
+    void MakeKey(UInt32 baseFormId, std::vector<UInt32> &modIds, Key &key)
+    {
+        std::sort(modIds.begin(), modIds.end());
+
+        key.clear();
+        key.reserve(modIds.size() + 1);
+        key.push_back(baseFormId);
+        key.insert(key.end(), modIds.begin(), modIds.end());
+    }
+
+    std::shared_ptr<const Components> Get(const Key &key)
+    {
+        SimpleLocker locker(&lock);
+
+        auto resultIt = resultByKey.find(key);
+        if(resultIt == resultByKey.end())
+        {
+            misses++;
+            return nullptr;
+        }
+
+        hits++;
+        results.splice(results.begin(), results, resultIt->second);
+        return resultIt->second->second;
+    }
+
+    void Put(const Key &key, const std::shared_ptr<const Components> &components)
+    {
+        SimpleLocker locker(&lock);
+
+        auto resultIt = resultByKey.find(key);
+        if(resultIt != resultByKey.end())
+        {
+            resultIt->second->second = components;
+            results.splice(results.begin(), results, resultIt->second);
+            return;
+        }
+
+        results.push_front(Result(key, components));
+        resultByKey[key] = results.begin();
+
+        if(results.size() > kMaxResults)
+        {
+            resultByKey.erase(results.back().first);
+            results.pop_back();
+        }
+    }
+
+    void Clear()
+    {
+        SimpleLocker locker(&lock);
+        results.clear();
+        resultByKey.clear();
+    }
+}
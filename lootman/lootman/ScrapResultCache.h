@@ -0,0 +1,40 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+
+#include "common/ITypes.h"
+
+class BGSComponent;
+
+// Results of scrapping, memoized by the base form and the set of attached mods. Identical weapons and armor are evaluated
+// over and over while looting, and their results only differ by the mods. The least recently used results are dropped first
+namespace ScrapResultCache
+{
+    struct Component
+    {
+        BGSComponent * component;
+        UInt32 index;       // Number of the component in ConstructibleObjectIndex
+        UInt32 count;
+    };
+
+    typedef std::vector<Component> Components;
+
+    // Identifies a result: the base form ID followed by the attached mod IDs in ascending order, so that the order of the mods does not matter
+    typedef std::vector<UInt32> Key;
+
+    // Make the key of the base form and the mods. The mod IDs are sorted in place
+    void MakeKey(UInt32 baseFormId, std::vector<UInt32> &modIds, Key &key);
+
+    // Get the memoized result of the key. Returns null if it is not memoized
+    std::shared_ptr<const Components> Get(const Key &key);
+
+    void Put(const Key &key, const std::shared_ptr<const Components> &components);
+
+    // Number of lookups answered from the cache, and number of lookups that were not
+    extern UInt32 hits;
+    extern UInt32 misses;
+
+    // Forget every result. Form IDs of created forms are reused after loading a save
+    void Clear();
+}
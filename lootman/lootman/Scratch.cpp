@@ -0,0 +1,156 @@
+#include "Scratch.h"
+
+#include <algorithm>
+
+namespace Scratch
+{
+    std::atomic<UInt32> allocations(0);
+
+    // Initial number of slots. Must be a power of 2
+    const UInt32 kInitialSlots = 1024;
+
+    IDSet::IDSet() : keys(kInitialSlots), stamps(kInitialSlots, 0), stamp(1), count(0)
+    {
+        allocations++;
+    }
+
+    void IDSet::Clear()
+    {
+        count = 0;
+        if(++stamp == 0)
+        {
+            // The stamp has wrapped around, so the old stamps can no longer be told apart
+            std::fill(stamps.begin(), stamps.end(), 0);
+            stamp = 1;
+        }
+    }
+
+    bool IDSet::Insert(UInt32 formId)
+    {
+        // Keep the load factor at or below 1/2
+        if((count + 1) * 2 > keys.size())
+        {
+            Grow();
+        }
+
+        UInt32 mask = (UInt32)keys.size() - 1;
+        for(UInt32 i = (formId * 0x9E3779B1) & mask; ; i = (i + 1) & mask)
+        {
+            if(stamps[i] != stamp)
+            {
+                keys[i] = formId;
+                stamps[i] = stamp;
+                count++;
+                return true;
+            }
+            if(keys[i] == formId)
+            {
+                return false;
+            }
+        }
+    }
+
+    void IDSet::Grow()
+    {
+        std::vector<UInt32> oldKeys;
+        std::vector<UInt32> oldStamps;
+        oldKeys.swap(keys);
+        oldStamps.swap(stamps);
+
+        keys.resize(oldKeys.size() * 2);
+        stamps.assign(oldKeys.size() * 2, 0);
+        allocations++;
+
+        UInt32 oldStamp = stamp;
+        stamp = 1;
+        count = 0;
+        for(size_t i = 0; i < oldKeys.size(); i++)
+        {
+            if(oldStamps[i] == oldStamp)
+            {
+                Insert(oldKeys[i]);
+            }
+        }
+    }
+
+    IDMap::IDMap() : keys(kInitialSlots), values(kInitialSlots), stamps(kInitialSlots, 0), stamp(1), count(0)
+    {
+        allocations++;
+    }
+
+    void IDMap::Clear()
+    {
+        count = 0;
+        if(++stamp == 0)
+        {
+            std::fill(stamps.begin(), stamps.end(), 0);
+            stamp = 1;
+        }
+    }
+
+    bool IDMap::Find(UInt32 formId, void *& value) const
+    {
+        UInt32 mask = (UInt32)keys.size() - 1;
+        for(UInt32 i = (formId * 0x9E3779B1) & mask; stamps[i] == stamp; i = (i + 1) & mask)
+        {
+            if(keys[i] == formId)
+            {
+                value = values[i];
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void IDMap::Insert(UInt32 formId, void * value)
+    {
+        if((count + 1) * 2 > keys.size())
+        {
+            Grow();
+        }
+
+        UInt32 mask = (UInt32)keys.size() - 1;
+        for(UInt32 i = (formId * 0x9E3779B1) & mask; ; i = (i + 1) & mask)
+        {
+            if(stamps[i] != stamp)
+            {
+                keys[i] = formId;
+                values[i] = value;
+                stamps[i] = stamp;
+                count++;
+                return;
+            }
+            if(keys[i] == formId)
+            {
+                values[i] = value;
+                return;
+            }
+        }
+    }
+
+    void IDMap::Grow()
+    {
+        std::vector<UInt32> oldKeys;
+        std::vector<void *> oldValues;
+        std::vector<UInt32> oldStamps;
+        oldKeys.swap(keys);
+        oldValues.swap(values);
+        oldStamps.swap(stamps);
+
+        keys.resize(oldKeys.size() * 2);
+        values.resize(oldKeys.size() * 2);
+        stamps.assign(oldKeys.size() * 2, 0);
+        allocations++;
+
+        UInt32 oldStamp = stamp;
+        stamp = 1;
+        count = 0;
+        for(size_t i = 0; i < oldKeys.size(); i++)
+        {
+            if(oldStamps[i] == oldStamp)
+            {
+                Insert(oldKeys[i], oldValues[i]);
+            }
+        }
+    }
+}
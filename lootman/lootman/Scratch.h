@@ -0,0 +1,83 @@
+#pragma once
+
+#include <atomic>
+#include <vector>
+
+#include "common/ITypes.h"
+
+// Buffers for the temporaries of a call. A buffer is kept by its thread and reused by the next call,
+// so that a call in the steady state makes no heap allocation.
+namespace Scratch
+{
+    // Number of times a scratch buffer of any thread had to allocate. Stays the same once the buffers are warmed up
+    extern std::atomic<UInt32> allocations;
+
+    // A vector that keeps its capacity between calls
+    template<typename T>
+    class Vector : public std::vector<T>
+    {
+    public:
+        Vector() : lastCapacity(0)
+        {
+        }
+
+        // Empty the vector for the next call. Growth in the previous call is counted as one allocation
+        void Reset()
+        {
+            if(this->capacity() != lastCapacity)
+            {
+                allocations++;
+                lastCapacity = this->capacity();
+            }
+            this->clear();
+        }
+
+    private:
+        size_t lastCapacity;
+    };
+
+    // A set of form IDs with open addressing. Each slot is stamped with the call that filled it,
+    // so clearing the set only advances the stamp instead of touching the slots
+    class IDSet
+    {
+    public:
+        IDSet();
+
+        void Clear();
+
+        // Insert the form ID. Returns false if it is already in the set
+        bool Insert(UInt32 formId);
+
+    private:
+        void Grow();
+
+        std::vector<UInt32> keys;
+        std::vector<UInt32> stamps;
+        UInt32 stamp;
+        UInt32 count;
+    };
+
+    // A map from form IDs to pointers, cleared by advancing the stamp in the same way as IDSet
+    class IDMap
+    {
+    public:
+        IDMap();
+
+        void Clear();
+
+        // Get the value of the form ID. Returns false if it is not in the map
+        bool Find(UInt32 formId, void *& value) const;
+
+        // Insert the form ID with the value, or replace its value
+        void Insert(UInt32 formId, void * value);
+
+    private:
+        void Grow();
+
+        std::vector<UInt32> keys;
+        std::vector<void *> values;
+        std::vector<UInt32> stamps;
+        UInt32 stamp;
+        UInt32 count;
+    };
+}
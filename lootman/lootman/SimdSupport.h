@@ -0,0 +1,34 @@
+#pragma once
+
+#include <immintrin.h>
+
+#include "common/ITypes.h"
+
+// The compiler specific parts of the SIMD kernels, so that the portable core also builds with GCC and Clang
+#ifdef _MSC_VER
+
+#include <intrin.h>
+
+// MSVC emits the instructions of any intrinsic without an option
+#define SIMD_TARGET_AVX2
+
+// Index of the lowest set bit. The mask must not be zero
+inline UInt32 LowestSetBit(UInt32 mask)
+{
+    unsigned long bit;
+    _BitScanForward(&bit, mask);
+    return bit;
+}
+
+#else
+
+// GCC and Clang only emit AVX2 instructions in the functions marked for it
+#define SIMD_TARGET_AVX2 __attribute__((target("avx2")))
+
+// Index of the lowest set bit. The mask must not be zero
+inline UInt32 LowestSetBit(UInt32 mask)
+{
+    return (UInt32)__builtin_ctz(mask);
+}
+
+#endif
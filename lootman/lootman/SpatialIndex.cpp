@@ -0,0 +1,351 @@
+#include "SpatialIndex.h"
+
+#include <algorithm>
+
+#include "xbyak/xbyak_util.h"
+
+#include "SimdSupport.h"
+
+namespace SpatialIndex
+{
+    // Filter the points from the start index one at a time. Used for the remainder of the SIMD kernels
+    UInt32 _FilterFrom(UInt32 start, const float * xs, const float * ys, const float * zs, const UInt32 * flags, UInt32 count,
+                       float x, float y, float z, float radiusSq, UInt32 rejectFlags, UInt32 * out)
+    {
+        UInt32 found = 0;
+        for(UInt32 i = start; i < count; i++)
+        {
+            float dx = x - xs[i];
+            float dy = y - ys[i];
+            float dz = z - zs[i];
+            if((dx * dx) + (dy * dy) + (dz * dz) <= radiusSq && (flags[i] & rejectFlags) == 0)
+            {
+                out[found++] = i;
+            }
+        }
+        return found;
+    }
+
+    UInt32 FilterScalar(const float * xs, const float * ys, const float * zs, const UInt32 * flags, UInt32 count,
+                        float x, float y, float z, float radiusSq, UInt32 rejectFlags, UInt32 * out)
+    {
+        return _FilterFrom(0, xs, ys, zs, flags, count, x, y, z, radiusSq, rejectFlags, out);
+    }
+
+    // 4 points at a time. Only SSE2 instructions are used, so this is available on every x64 CPU
+    UInt32 FilterSSE(const float * xs, const float * ys, const float * zs, const UInt32 * flags, UInt32 count,
+                     float x, float y, float z, float radiusSq, UInt32 rejectFlags, UInt32 * out)
+    {
+        __m128 px = _mm_set1_ps(x);
+        __m128 py = _mm_set1_ps(y);
+        __m128 pz = _mm_set1_ps(z);
+        __m128 r = _mm_set1_ps(radiusSq);
+        __m128i reject = _mm_set1_epi32((int)rejectFlags);
+        __m128i zero = _mm_setzero_si128();
+
+        UInt32 found = 0;
+        UInt32 i = 0;
+        for(; i + 4 <= count; i += 4)
+        {
+            __m128 dx = _mm_sub_ps(px, _mm_loadu_ps(xs + i));
+            __m128 dy = _mm_sub_ps(py, _mm_loadu_ps(ys + i));
+            __m128 dz = _mm_sub_ps(pz, _mm_loadu_ps(zs + i));
+            __m128 distanceSq = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+            __m128 inRange = _mm_cmple_ps(distanceSq, r);
+
+            __m128i rejected = _mm_and_si128(_mm_loadu_si128((const __m128i *)(flags + i)), reject);
+            __m128 accepted = _mm_castsi128_ps(_mm_cmpeq_epi32(rejected, zero));
+
+            int mask = _mm_movemask_ps(_mm_and_ps(inRange, accepted));
+            while(mask)
+            {
+                out[found++] = i + LowestSetBit(mask);
+                mask &= mask - 1;
+            }
+        }
+
+        return found + _FilterFrom(i, xs, ys, zs, flags, count, x, y, z, radiusSq, rejectFlags, out + found);
+    }
+
+    // 8 points at a time
+    SIMD_TARGET_AVX2
+    UInt32 FilterAVX2(const float * xs, const float * ys, const float * zs, const UInt32 * flags, UInt32 count,
+                      float x, float y, float z, float radiusSq, UInt32 rejectFlags, UInt32 * out)
+    {
+        __m256 px = _mm256_set1_ps(x);
+        __m256 py = _mm256_set1_ps(y);
+        __m256 pz = _mm256_set1_ps(z);
+        __m256 r = _mm256_set1_ps(radiusSq);
+        __m256i reject = _mm256_set1_epi32((int)rejectFlags);
+        __m256i zero = _mm256_setzero_si256();
+
+        UInt32 found = 0;
+        UInt32 i = 0;
+        for(; i + 8 <= count; i += 8)
+        {
+            __m256 dx = _mm256_sub_ps(px, _mm256_loadu_ps(xs + i));
+            __m256 dy = _mm256_sub_ps(py, _mm256_loadu_ps(ys + i));
+            __m256 dz = _mm256_sub_ps(pz, _mm256_loadu_ps(zs + i));
+            __m256 distanceSq = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy)), _mm256_mul_ps(dz, dz));
+            __m256 inRange = _mm256_cmp_ps(distanceSq, r, _CMP_LE_OQ);
+
+            __m256i rejected = _mm256_and_si256(_mm256_loadu_si256((const __m256i *)(flags + i)), reject);
+            __m256 accepted = _mm256_castsi256_ps(_mm256_cmpeq_epi32(rejected, zero));
+
+            int mask = _mm256_movemask_ps(_mm256_and_ps(inRange, accepted));
+            while(mask)
+            {
+                out[found++] = i + LowestSetBit(mask);
+                mask &= mask - 1;
+            }
+        }
+        _mm256_zeroupper();
+
+        return found + _FilterFrom(i, xs, ys, zs, flags, count, x, y, z, radiusSq, rejectFlags, out + found);
+    }
+
+    FilterKernel _SelectFilter()
+    {
+        Xbyak::util::Cpu cpu;
+        if(cpu.has(Xbyak::util::Cpu::tAVX2))
+        {
+            return FilterAVX2;
+        }
+        if(cpu.has(Xbyak::util::Cpu::tSSE2))
+        {
+            return FilterSSE;
+        }
+        return FilterScalar;
+    }
+
+    FilterKernel Filter = _SelectFilter();
+
+    void Bounds::Reset(const Entry &entry)
+    {
+        minX = maxX = entry.x;
+        minY = maxY = entry.y;
+        minZ = maxZ = entry.z;
+    }
+
+    void Bounds::Expand(const Entry &entry)
+    {
+        minX = (std::min)(minX, entry.x);
+        minY = (std::min)(minY, entry.y);
+        minZ = (std::min)(minZ, entry.z);
+        maxX = (std::max)(maxX, entry.x);
+        maxY = (std::max)(maxY, entry.y);
+        maxZ = (std::max)(maxZ, entry.z);
+    }
+
+    bool Bounds::IntersectsSphere(float x, float y, float z, float radiusSq) const
+    {
+        float dz = z < minZ ? minZ - z : (z > maxZ ? z - maxZ : 0.0f);
+        return DistanceSqToBox(x, y, minX, minY, maxX, maxY) + (dz * dz) <= radiusSq;
+    }
+
+    void Bucket::Set(UInt32 index, const Entry &entry)
+    {
+        xs[index] = entry.x;
+        ys[index] = entry.y;
+        zs[index] = entry.z;
+        flags[index] = entry.flags;
+        formIds[index] = entry.formId;
+        cellIds[index] = entry.cellId;
+        cells[index] = entry.cell;
+        refs[index] = entry.ref;
+        bounds.Expand(entry);
+    }
+
+    void Bucket::Push(const Entry &entry)
+    {
+        if(formIds.empty())
+        {
+            bounds.Reset(entry);
+        }
+        else
+        {
+            bounds.Expand(entry);
+        }
+
+        xs.push_back(entry.x);
+        ys.push_back(entry.y);
+        zs.push_back(entry.z);
+        flags.push_back(entry.flags);
+        formIds.push_back(entry.formId);
+        cellIds.push_back(entry.cellId);
+        cells.push_back(entry.cell);
+        refs.push_back(entry.ref);
+    }
+
+    void Bucket::SwapRemove(UInt32 index)
+    {
+        UInt32 last = (UInt32)formIds.size() - 1;
+        if(index != last)
+        {
+            xs[index] = xs[last];
+            ys[index] = ys[last];
+            zs[index] = zs[last];
+            flags[index] = flags[last];
+            formIds[index] = formIds[last];
+            cellIds[index] = cellIds[last];
+            cells[index] = cells[last];
+            refs[index] = refs[last];
+        }
+
+        xs.pop_back();
+        ys.pop_back();
+        zs.pop_back();
+        flags.pop_back();
+        formIds.pop_back();
+        cellIds.pop_back();
+        cells.pop_back();
+        refs.pop_back();
+    }
+
+    Entry Bucket::Get(UInt32 index, UInt8 formType) const
+    {
+        Entry entry;
+        entry.formId = formIds[index];
+        entry.cellId = cellIds[index];
+        entry.cell = cells[index];
+        entry.formType = formType;
+        entry.flags = flags[index];
+        entry.x = xs[index];
+        entry.y = ys[index];
+        entry.z = zs[index];
+        entry.ref = refs[index];
+        return entry;
+    }
+
+    SInt32 ToGrid(float value)
+    {
+        return (SInt32)std::floor(value / kGridSize);
+    }
+
+    UInt64 MakeKey(UInt32 spaceId, SInt32 gx, SInt32 gy, UInt8 formType)
+    {
+        // 11 bits of grid X wrap every 2048 squares, far wider than any world space
+        return ((UInt64)spaceId << 32) | ((UInt64)(gx & 0x7FF) << 20) | ((UInt64)(gy & 0xFFF) << 8) | formType;
+    }
+
+    UInt64 MakeMovableKey(UInt32 spaceId, UInt8 formType)
+    {
+        return ((UInt64)spaceId << 32) | ((UInt64)1 << 31) | formType;
+    }
+
+    float DistanceSqToBox(float x, float y, float minX, float minY, float maxX, float maxY)
+    {
+        float dx = x < minX ? minX - x : (x > maxX ? x - maxX : 0.0f);
+        float dy = y < minY ? minY - y : (y > maxY ? y - maxY : 0.0f);
+        return (dx * dx) + (dy * dy);
+    }
+
+    Grid::Grid() : changed(false), publishedStamp(0), snapshot(std::make_shared<Snapshot>(BucketMap(), 0, 0))
+    {
+    }
+
+    Bucket & Grid::GetWritableBucket(UInt64 key)
+    {
+        std::shared_ptr<Bucket> &bucket = buckets[key];
+        if(privateKeys.insert(key).second)
+        {
+            bucket = bucket ? std::make_shared<Bucket>(*bucket) : std::make_shared<Bucket>();
+        }
+        changed = true;
+        return *bucket;
+    }
+
+    void Grid::Insert(UInt32 spaceId, const Entry &entry)
+    {
+        UInt64 key = (entry.flags & kEntryFlag_Movable) != 0 ? MakeMovableKey(spaceId, entry.formType) : MakeKey(spaceId, ToGrid(entry.x), ToGrid(entry.y), entry.formType);
+
+        auto locationIt = locations.find(entry.formId);
+        if(locationIt != locations.end())
+        {
+            Location &location = locationIt->second;
+            if(location.key == key)
+            {
+                GetWritableBucket(key).Set(location.index, entry);
+                return;
+            }
+
+            // The reference has moved to another grid square
+            Remove(entry.formId);
+        }
+
+        Bucket &bucket = GetWritableBucket(key);
+        Location location;
+        location.key = key;
+        location.index = (UInt32)bucket.formIds.size();
+        bucket.Push(entry);
+        locations[entry.formId] = location;
+    }
+
+    void Grid::Remove(UInt32 formId)
+    {
+        auto locationIt = locations.find(formId);
+        if(locationIt == locations.end())
+        {
+            return;
+        }
+
+        UInt64 key = locationIt->second.key;
+        Bucket &bucket = GetWritableBucket(key);
+        UInt32 index = locationIt->second.index;
+
+        // Swap with the last entry so that removal does not shift the bucket
+        bucket.SwapRemove(index);
+        if(index < bucket.formIds.size())
+        {
+            locations[bucket.formIds[index]].index = index;
+        }
+
+        if(bucket.formIds.empty())
+        {
+            buckets.erase(key);
+            privateKeys.erase(key);
+        }
+        locations.erase(formId);
+    }
+
+    bool Grid::GetCellID(UInt32 formId, UInt32 &cellId) const
+    {
+        auto locationIt = locations.find(formId);
+        if(locationIt == locations.end())
+        {
+            return false;
+        }
+
+        cellId = buckets.find(locationIt->second.key)->second->cellIds[locationIt->second.index];
+        return true;
+    }
+
+    void Grid::Clear()
+    {
+        buckets.clear();
+        locations.clear();
+        privateKeys.clear();
+        changed = true;
+    }
+
+    void Grid::Publish(UInt32 stamp)
+    {
+        if(!changed && stamp == publishedStamp)
+        {
+            return;
+        }
+
+        // Only the bucket pointers are copied, the buckets themselves are shared until they change again
+        std::shared_ptr<const Snapshot> published = std::make_shared<Snapshot>(BucketMap(buckets.begin(), buckets.end()), locations.size(), stamp);
+        std::atomic_store(&snapshot, published);
+
+        privateKeys.clear();
+        changed = false;
+        publishedStamp = stamp;
+    }
+
+    std::shared_ptr<const Snapshot> Grid::GetSnapshot() const
+    {
+        return std::atomic_load(&snapshot);
+    }
+}
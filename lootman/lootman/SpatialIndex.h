@@ -0,0 +1,299 @@
+#pragma once
+
+#include <atomic>
+#include <cmath>
+#include <memory>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "common/ITypes.h"
+
+// A uniform grid of object references keyed by world coordinates. The core only deals with form IDs and
+// coordinates so that it does not depend on the game, the glue for the load events lives in FormIDCache.
+namespace SpatialIndex
+{
+    // Edge length of a grid square. Same as the edge length of an exterior cell
+    const float kGridSize = 4096.0f;
+
+    // Distance a reference that is not movable may have been pushed from its indexed position, by physics for example.
+    // Callers pad the radius of a query with it and check the live position of what is found
+    const float kPositionSlack = 512.0f;
+
+    // Properties of a reference that do not change while it is loaded, so that the query can reject it without touching it
+    enum
+    {
+        kEntryFlag_NotPlayable  = 1 << 0,
+        kEntryFlag_NativeObject = 1 << 1,
+        kEntryFlag_Excluded     = 1 << 2,
+        kEntryFlag_Movable      = 1 << 3    // The reference walks away from where it was loaded, so it is not bucketed by its position
+    };
+
+    struct Entry
+    {
+        UInt32 formId;      // Form ID of the reference
+        UInt32 cellId;      // Form ID of the parent cell
+        void * cell;        // The parent cell itself, only valid while the stamp of the snapshot is current
+        UInt8 formType;     // Form type of the base form
+        UInt32 flags;       // kEntryFlag_*
+        float x;
+        float y;
+        float z;
+        void * ref;         // The reference itself, only valid while it is loaded
+    };
+
+    // Write the indices of the points within the squared radius whose flags have no bit of the reject flags, and return the number of indices written
+    typedef UInt32 (* FilterKernel)(const float * xs, const float * ys, const float * zs, const UInt32 * flags, UInt32 count,
+                                    float x, float y, float z, float radiusSq, UInt32 rejectFlags, UInt32 * out);
+
+    UInt32 FilterScalar(const float * xs, const float * ys, const float * zs, const UInt32 * flags, UInt32 count,
+                        float x, float y, float z, float radiusSq, UInt32 rejectFlags, UInt32 * out);
+
+    UInt32 FilterSSE(const float * xs, const float * ys, const float * zs, const UInt32 * flags, UInt32 count,
+                     float x, float y, float z, float radiusSq, UInt32 rejectFlags, UInt32 * out);
+
+    UInt32 FilterAVX2(const float * xs, const float * ys, const float * zs, const UInt32 * flags, UInt32 count,
+                      float x, float y, float z, float radiusSq, UInt32 rejectFlags, UInt32 * out);
+
+    // The fastest kernel supported by the CPU, selected when the plugin is loaded
+    extern FilterKernel Filter;
+
+    // Axis-aligned bounding box of the positions in a bucket. It only grows while the bucket lives,
+    // which keeps it conservative without rescanning the bucket on removal
+    struct Bounds
+    {
+        float minX, minY, minZ;
+        float maxX, maxY, maxZ;
+
+        void Reset(const Entry &entry);
+        void Expand(const Entry &entry);
+        bool IntersectsSphere(float x, float y, float z, float radiusSq) const;
+    };
+
+    // Entries of a grid square and a form type. Stored as a structure of arrays so that the filter kernel reads contiguous coordinates
+    struct Bucket
+    {
+        std::vector<float> xs;
+        std::vector<float> ys;
+        std::vector<float> zs;
+        std::vector<UInt32> flags;
+        std::vector<UInt32> formIds;
+        std::vector<UInt32> cellIds;
+        std::vector<void *> cells;
+        std::vector<void *> refs;
+        Bounds bounds;
+
+        void Set(UInt32 index, const Entry &entry);
+        void Push(const Entry &entry);
+        void SwapRemove(UInt32 index);
+        Entry Get(UInt32 index, UInt8 formType) const;
+    };
+
+    typedef std::unordered_map<UInt64, std::shared_ptr<const Bucket>> BucketMap;
+
+    SInt32 ToGrid(float value);
+
+    // Key layout: [space ID: 32 bits][movable: 1 bit][grid X: 11 bits][grid Y: 12 bits][form type: 8 bits]
+    UInt64 MakeKey(UInt32 spaceId, SInt32 gx, SInt32 gy, UInt8 formType);
+
+    // Key of the bucket of the movable entries of a space and a form type, which has no grid square
+    UInt64 MakeMovableKey(UInt32 spaceId, UInt8 formType);
+
+    // Squared distance from the point to the nearest point of the rectangle. Zero if the point is inside
+    float DistanceSqToBox(float x, float y, float minX, float minY, float maxX, float maxY);
+
+    // An immutable view of the index. Buckets are shared between snapshots until the writer changes them,
+    // and a snapshot is freed when the last reader drops it, so queries need no lock at all
+    class Snapshot
+    {
+    public:
+        Snapshot(BucketMap buckets, size_t size, UInt32 stamp) : size(size), stamp(stamp)
+        {
+            this->buckets.swap(buckets);
+        }
+
+        size_t Size() const
+        {
+            return size;
+        }
+
+        // The value given by the writer when the snapshot was published
+        UInt32 GetStamp() const
+        {
+            return stamp;
+        }
+
+        // Call the functor with every entry of the form type that is within the radius and has no bit of the reject flags, and with every
+        // movable entry of the form type wherever it is. The hits vector is scratch for the kernel output, owned by the caller because
+        // snapshots are read by several threads at once
+        template<typename F>
+        void Query(UInt32 spaceId, float x, float y, float z, float radius, UInt8 formType, UInt32 rejectFlags, std::vector<UInt32> &hits, F f) const
+        {
+            QueryMovable(spaceId, formType, rejectFlags, f);
+
+            SInt32 minX = ToGrid(x - radius);
+            SInt32 maxX = ToGrid(x + radius);
+            SInt32 minY = ToGrid(y - radius);
+            SInt32 maxY = ToGrid(y + radius);
+
+            for(SInt32 gx = minX; gx <= maxX; gx++)
+            {
+                for(SInt32 gy = minY; gy <= maxY; gy++)
+                {
+                    QuerySquare(spaceId, gx, gy, x, y, z, radius, formType, rejectFlags, hits, f);
+                }
+            }
+        }
+
+        // Call the functor with every movable entry of the form type that has no bit of the reject flags. Their indexed positions
+        // are not checked, the caller checks where the references are now
+        template<typename F>
+        void QueryMovable(UInt32 spaceId, UInt8 formType, UInt32 rejectFlags, F &f) const
+        {
+            auto it = buckets.find(MakeMovableKey(spaceId, formType));
+            if(it == buckets.end())
+            {
+                return;
+            }
+
+            const Bucket &bucket = *it->second;
+            for(UInt32 i = 0; i < (UInt32)bucket.formIds.size(); i++)
+            {
+                if((bucket.flags[i] & rejectFlags) == 0)
+                {
+                    f(bucket.Get(i, formType));
+                }
+            }
+        }
+
+        // Same as QueryMovable, but in slices for the scans that are split over several calls. Starts at the position in the bucket and
+        // stops before an entry as soon as isOverBudget returns true. Returns true once the end of the bucket has been reached
+        template<typename B, typename F>
+        bool QueryMovable(UInt32 spaceId, UInt8 formType, UInt32 rejectFlags, UInt32 &position, B &isOverBudget, F &f) const
+        {
+            auto it = buckets.find(MakeMovableKey(spaceId, formType));
+            if(it == buckets.end())
+            {
+                return true;
+            }
+
+            const Bucket &bucket = *it->second;
+            for(; position < (UInt32)bucket.formIds.size(); position++)
+            {
+                if(isOverBudget())
+                {
+                    return false;
+                }
+
+                if((bucket.flags[position] & rejectFlags) == 0)
+                {
+                    f(bucket.Get(position, formType));
+                }
+            }
+            return true;
+        }
+
+        // Same as Query, but only for one grid square and without the movable entries. Used by the scans that are split over several calls
+        template<typename F>
+        void QuerySquare(UInt32 spaceId, SInt32 gx, SInt32 gy, float x, float y, float z, float radius, UInt8 formType, UInt32 rejectFlags, std::vector<UInt32> &hits, F &f) const
+        {
+            float radiusSq = radius * radius;
+
+            // The corners of the covering rectangle are often out of the circle, skip them before the lookup
+            float squareMinX = gx * kGridSize;
+            float squareMinY = gy * kGridSize;
+            if(DistanceSqToBox(x, y, squareMinX, squareMinY, squareMinX + kGridSize, squareMinY + kGridSize) > radiusSq)
+            {
+                return;
+            }
+
+            auto it = buckets.find(MakeKey(spaceId, gx, gy, formType));
+            if(it == buckets.end())
+            {
+                return;
+            }
+
+            const Bucket &bucket = *it->second;
+            if(!bucket.bounds.IntersectsSphere(x, y, z, radiusSq))
+            {
+                return;
+            }
+
+            UInt32 count = (UInt32)bucket.formIds.size();
+            if(hits.size() < count)
+            {
+                hits.resize(count);
+            }
+
+            UInt32 found = Filter(&bucket.xs[0], &bucket.ys[0], &bucket.zs[0], &bucket.flags[0], count, x, y, z, radiusSq, rejectFlags, &hits[0]);
+            for(UInt32 i = 0; i < found; i++)
+            {
+                f(bucket.Get(hits[i], formType));
+            }
+        }
+
+    private:
+        BucketMap buckets;
+        size_t size;
+        UInt32 stamp;
+    };
+
+    // The writer side of the index. Changes are made on private copies of the buckets (copy-on-write) and become
+    // visible to the readers when they are published as a new snapshot. The writer methods must be serialized by the owner
+    class Grid
+    {
+    public:
+        Grid();
+
+        // Insert the entry, or move it if the reference is already indexed. The space ID separates the coordinate
+        // systems: the world space ID for exterior cells, and the cell ID for interior cells.
+        void Insert(UInt32 spaceId, const Entry &entry);
+
+        // Remove the reference from the index. Does nothing if it is not indexed
+        void Remove(UInt32 formId);
+
+        // Get the parent cell ID the reference was indexed with. Returns false if it is not indexed
+        bool GetCellID(UInt32 formId, UInt32 &cellId) const;
+
+        void Clear();
+
+        size_t Size() const
+        {
+            return locations.size();
+        }
+
+        // Make the changes since the last publication visible to the readers, with a stamp the readers can validate
+        // what the entries point to against. Does nothing if there is no change and the stamp is the same
+        void Publish(UInt32 stamp);
+
+        // Verify that every change and the stamp have been published. Safe to call from any thread without the owner's lock,
+        // so that a reader only takes the lock to publish when there is something to publish
+        bool IsPublished(UInt32 stamp) const
+        {
+            return !changed && publishedStamp == stamp;
+        }
+
+        // Get the latest published snapshot. Safe to call from any thread without the owner's lock
+        std::shared_ptr<const Snapshot> GetSnapshot() const;
+
+    private:
+        struct Location
+        {
+            UInt64 key;
+            UInt32 index;
+        };
+
+        // Get the bucket for writing, copying it first if it may be shared with a published snapshot
+        Bucket & GetWritableBucket(UInt64 key);
+
+        std::unordered_map<UInt64, std::shared_ptr<Bucket>> buckets;
+        std::unordered_map<UInt32, Location> locations;
+
+        // Buckets copied or created since the last publication, which no snapshot refers to
+        std::unordered_set<UInt64> privateKeys;
+        std::atomic<bool> changed;
+        std::atomic<UInt32> publishedStamp;
+
+        std::shared_ptr<const Snapshot> snapshot;
+    };
+}
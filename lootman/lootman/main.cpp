@@ -3,15 +3,21 @@
 #include "f4se/PluginAPI.h"
 #include "f4se_common/f4se_version.h"
 
+#include "ConstructibleObjectIndex.h"
+#include "FormClassCache.h"
 #include "FormIDCache.h"
 #include "InjectionData.h"
+#include "InventoryDigestCache.h"
 #include "PapyrusLootman.h"
+#include "PreScanWorker.h"
+#include "ScrapResultCache.h"
 
 IDebugLog gLog;
 
 PluginHandle pluginHandle = kPluginHandle_Invalid;
 F4SEPapyrusInterface * papyrus = nullptr;
 F4SEMessagingInterface * messaging = nullptr;
+F4SEObjectInterface * object = nullptr;
 
 void Messaging(F4SEMessagingInterface::Message * msg)
 {
@@ -21,6 +27,24 @@ void Messaging(F4SEMessagingInterface::Message * msg)
         GetEventDispatcher<TESObjectLoadedEvent>()->AddEventSink(&FormIDCache::eventListener);
         _MESSAGE(">>   Form ID cache is registered.");
     }
+    else if(msg->type == F4SEMessagingInterface::kMessage_GameDataReady && msg->data)
+    {
+        InjectionData::CompileExclusions();
+        FormClassCache::Clear();
+        _MESSAGE(">>   Exclusion lists are compiled.");
+        ConstructibleObjectIndex::Build();
+    }
+    else if(msg->type == F4SEMessagingInterface::kMessage_PreLoadGame)
+    {
+        FormIDCache::Clear();
+        FormClassCache::Clear();
+        InventoryDigestCache::Clear();
+        ScrapResultCache::Clear();
+        PapyrusLootman::ClearScanCursors();
+        PapyrusLootman::ClearBudgetedScans();
+        PreScanWorker::Clear();
+        _MESSAGE(">>   Form ID cache is cleared.");
+    }
 }
 
 extern "C"
@@ -62,6 +86,13 @@ extern "C"
             return false;
         }
 
+        object = (F4SEObjectInterface *)f4se->QueryInterface(kInterface_Object);
+        if(!object)
+        {
+            _FATALERROR(">>   Couldn't get object interface");
+            return false;
+        }
+
         _MESSAGE(">> Lootman plugin query phase end.");
         return true;
     }
@@ -76,6 +107,14 @@ extern "C"
             return false;
         }
 
+        if(!PapyrusLootman::SetObjectInterface(object))
+        {
+            _FATALERROR(">>   Failed to register the delay functors.");
+            return false;
+        }
+
+        PreScanWorker::SetSource(FormIDCache::GetSnapshot, FormIDCache::GetIndexedFormTypes());
+
         if(!papyrus->Register(PapyrusLootman::RegisterFuncs))
         {
             _FATALERROR(">>   Failed to register papyrus functions.");
@@ -0,0 +1,248 @@
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "SpatialIndex.h"
+#include "TestSupport.h"
+
+using namespace SpatialIndex;
+
+// Loader threads write the grid under a spin lock while scan threads query it, the way FormIDCache is used in game.
+// Run once with a publication per event, as the writers used to do, and once with the publications left to the readers
+namespace
+{
+    const UInt32 kSpaceId = 0x3C;
+    const UInt32 kLoaderThreads = 4;
+    const UInt32 kScanThreads = 2;
+    const UInt32 kRefsPerLoader = 5000;
+    const UInt32 kDurationMilliseconds = 1000;
+    const float kWorldSize = 40000.0f;
+
+    // Stand-in for the SimpleLock of F4SE, which spins as well
+    class SpinLock
+    {
+    public:
+        SpinLock()
+        {
+            flag.clear();
+        }
+
+        void Lock()
+        {
+            while(flag.test_and_set(std::memory_order_acquire))
+            {
+                std::this_thread::yield();
+            }
+        }
+
+        void Unlock()
+        {
+            flag.clear(std::memory_order_release);
+        }
+
+    private:
+        std::atomic_flag flag;
+    };
+
+    struct Result
+    {
+        UInt64 events;
+        UInt64 queries;
+        UInt64 publications;
+        double maxHoldMicroseconds;
+        double totalHoldMicroseconds;
+    };
+
+    Entry MakeEntry(Random &random, UInt32 formId)
+    {
+        Entry entry;
+        entry.formId = formId;
+        entry.cellId = 1;
+        entry.cell = nullptr;
+        entry.formType = (UInt8)(40 + random.Next() % 2);
+        entry.flags = random.Percent(2) ? (UInt32)kEntryFlag_Movable : 0;
+        entry.x = random.Range(-kWorldSize / 2, kWorldSize / 2);
+        entry.y = random.Range(-kWorldSize / 2, kWorldSize / 2);
+        entry.z = 0.0f;
+        entry.ref = nullptr;
+        return entry;
+    }
+
+    Result Run(bool publishPerEvent)
+    {
+        Grid grid;
+        SpinLock lock;
+        std::atomic<bool> stop(false);
+        std::atomic<UInt64> events(0);
+        std::atomic<UInt64> queries(0);
+        std::atomic<UInt64> publications(0);
+        std::atomic<UInt64> totalHoldNanoseconds(0);
+        std::atomic<UInt64> maxHoldNanoseconds(0);
+
+        auto hold = [&](const Stopwatch &stopwatch)
+        {
+            UInt64 nanoseconds = (UInt64)(stopwatch.ElapsedMicroseconds() * 1000.0);
+            totalHoldNanoseconds += nanoseconds;
+            UInt64 max = maxHoldNanoseconds;
+            while(nanoseconds > max && !maxHoldNanoseconds.compare_exchange_weak(max, nanoseconds))
+            {
+            }
+        };
+
+        // Each loader owns a range of form IDs, and knows what it has left in the grid
+        std::vector<std::unordered_map<UInt32, Entry>> loaded(kLoaderThreads);
+        std::vector<std::thread> threads;
+        for(UInt32 t = 0; t < kLoaderThreads; t++)
+        {
+            threads.push_back(std::thread([&, t]()
+            {
+                Random random(t + 1);
+                std::unordered_map<UInt32, Entry> &entries = loaded[t];
+                UInt32 firstFormId = (t + 1) * 0x100000;
+                while(!stop)
+                {
+                    UInt32 formId = firstFormId + random.Next() % kRefsPerLoader;
+                    bool remove = entries.find(formId) != entries.end() && random.Percent(30);
+                    Entry entry = MakeEntry(random, formId);
+
+                    lock.Lock();
+                    Stopwatch stopwatch;
+                    if(remove)
+                    {
+                        grid.Remove(formId);
+                    }
+                    else
+                    {
+                        grid.Insert(kSpaceId, entry);
+                    }
+                    if(publishPerEvent)
+                    {
+                        grid.Publish(1);
+                        publications++;
+                    }
+                    hold(stopwatch);
+                    lock.Unlock();
+
+                    if(remove)
+                    {
+                        entries.erase(formId);
+                    }
+                    else
+                    {
+                        entries[formId] = entry;
+                    }
+                    events++;
+
+                    // A loader thread does the rest of the loading between two events
+                    std::this_thread::yield();
+                }
+            }));
+        }
+
+        for(UInt32 t = 0; t < kScanThreads; t++)
+        {
+            threads.push_back(std::thread([&, t]()
+            {
+                Random random(100 + t);
+                std::vector<UInt32> hits;
+                while(!stop)
+                {
+                    if(!publishPerEvent && !grid.IsPublished(1))
+                    {
+                        lock.Lock();
+                        Stopwatch stopwatch;
+                        grid.Publish(1);
+                        hold(stopwatch);
+                        lock.Unlock();
+                        publications++;
+                    }
+
+                    // Whatever the snapshot, every entry it returns matches the query
+                    std::shared_ptr<const Snapshot> snapshot = grid.GetSnapshot();
+                    float x = random.Range(-kWorldSize / 2, kWorldSize / 2);
+                    float y = random.Range(-kWorldSize / 2, kWorldSize / 2);
+                    float radius = 5000.0f;
+                    UInt8 formType = (UInt8)(40 + random.Next() % 2);
+                    snapshot->Query(kSpaceId, x, y, 0.0f, radius, formType, 0, hits, [&](const Entry &entry)
+                    {
+                        float dx = x - entry.x;
+                        float dy = y - entry.y;
+                        CHECK(entry.formType == formType);
+                        CHECK((entry.flags & kEntryFlag_Movable) != 0 || (dx * dx) + (dy * dy) <= radius * radius);
+                    });
+                    queries++;
+                }
+            }));
+        }
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(kDurationMilliseconds));
+        stop = true;
+        for(std::thread &thread : threads)
+        {
+            thread.join();
+        }
+
+        // After the last publication, the snapshot has exactly what the loaders left
+        grid.Publish(1);
+        std::shared_ptr<const Snapshot> snapshot = grid.GetSnapshot();
+        size_t expectedCount = 0;
+        for(auto &entries : loaded)
+        {
+            expectedCount += entries.size();
+        }
+        CHECK(grid.Size() == expectedCount);
+        CHECK(snapshot->Size() == expectedCount);
+
+        std::vector<UInt32> hits;
+        for(UInt8 formType = 40; formType <= 41; formType++)
+        {
+            std::vector<UInt32> actual;
+            snapshot->Query(kSpaceId, 0.0f, 0.0f, 0.0f, kWorldSize, formType, 0, hits, [&actual](const Entry &entry)
+            {
+                actual.push_back(entry.formId);
+            });
+
+            std::vector<UInt32> expected;
+            for(auto &entries : loaded)
+            {
+                for(auto &element : entries)
+                {
+                    if(element.second.formType == formType)
+                    {
+                        expected.push_back(element.first);
+                    }
+                }
+            }
+
+            std::sort(actual.begin(), actual.end());
+            std::sort(expected.begin(), expected.end());
+            CHECK(actual == expected);
+        }
+
+        Result result;
+        result.events = events;
+        result.queries = queries;
+        result.publications = publications;
+        result.maxHoldMicroseconds = maxHoldNanoseconds / 1000.0;
+        result.totalHoldMicroseconds = totalHoldNanoseconds / 1000.0;
+        return result;
+    }
+
+    void Print(const char * name, const Result &result)
+    {
+        std::printf("%-18s %12llu %12llu %12llu %14.3f %14.1f\n", name, (unsigned long long)result.events, (unsigned long long)result.queries,
+                    (unsigned long long)result.publications, result.totalHoldMicroseconds / (std::max)(result.events, (UInt64)1), result.maxHoldMicroseconds);
+    }
+}
+
+int main()
+{
+    std::printf("%u loader threads, %u scan threads, %u ms per run\n", kLoaderThreads, kScanThreads, kDurationMilliseconds);
+    std::printf("%-18s %12s %12s %12s %14s %14s\n", "publication", "events", "queries", "publications", "us held/event", "max held us");
+    Print("per event", Run(true));
+    Print("by the readers", Run(false));
+    std::printf("GridContentionTest: OK\n");
+    return 0;
+}
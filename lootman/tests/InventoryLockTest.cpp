@@ -0,0 +1,386 @@
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "TestSupport.h"
+
+// Writer threads change an inventory under its read-write lock while a reader builds digests of it, the way the game and
+// InventoryDigestCache share a BGSInventoryList. Run once classifying the items under the lock, as the reads used to do, and
+// once copying plain values under the lock and classifying them after it is released. Both give the same digest
+namespace
+{
+    const UInt32 kWriterThreads = 2;
+    const UInt32 kItems = 300;
+    const UInt32 kMods = 5000;
+    const UInt32 kKeywordsPerMod = 12;
+    const UInt32 kLegendaryKeyword = 0xABCD;
+    const UInt32 kDurationMilliseconds = 1000;
+
+    // Stand-in for the BSReadWriteLock of the game, which spins as well
+    class ReadWriteLock
+    {
+    public:
+        ReadWriteLock() : state(0)
+        {
+        }
+
+        void LockForRead()
+        {
+            for(;;)
+            {
+                SInt32 current = state;
+                if(current >= 0 && state.compare_exchange_weak(current, current + 1))
+                {
+                    return;
+                }
+                std::this_thread::yield();
+            }
+        }
+
+        void UnlockRead()
+        {
+            state--;
+        }
+
+        void LockForWrite()
+        {
+            for(;;)
+            {
+                SInt32 expected = 0;
+                if(state.compare_exchange_weak(expected, -1))
+                {
+                    return;
+                }
+                std::this_thread::yield();
+            }
+        }
+
+        void UnlockWrite()
+        {
+            state = 0;
+        }
+
+    private:
+        std::atomic<SInt32> state;
+    };
+
+    // Forms are polymorphic, so that the classification pays for the casts the way the RTTI casts of the game do
+    class Form
+    {
+    public:
+        virtual ~Form()
+        {
+        }
+
+        UInt32 formId;
+        bool isEquipment;
+    };
+
+    class PlayableForm : public Form
+    {
+    };
+
+    class NotPlayableForm : public Form
+    {
+    };
+
+    class Mod : public Form
+    {
+    public:
+        std::vector<UInt32> keywords;
+    };
+
+    struct Stack
+    {
+        SInt32 count;
+        UInt16 flags;
+        std::vector<UInt32> modIds;
+    };
+
+    struct InventoryItem
+    {
+        Form * form;
+        std::vector<Stack> stacks;
+    };
+
+    struct DigestItem
+    {
+        Form * form;
+        SInt32 count;
+        bool isDropped;
+        bool isLegendary;
+
+        bool operator==(const DigestItem &other) const
+        {
+            return form == other.form && count == other.count && isDropped == other.isDropped && isLegendary == other.isLegendary;
+        }
+    };
+
+    // Same as InventoryDigestCache::ItemSnapshot
+    struct ItemSnapshot
+    {
+        Form * form;
+        SInt32 count;
+        UInt16 stackFlags;
+        UInt32 firstModId;
+        UInt32 modIdCount;
+    };
+
+    struct World
+    {
+        std::unordered_map<UInt32, Form *> mods;    // Stand-in for LookupFormByID
+        std::vector<InventoryItem> inventory;
+        ReadWriteLock lock;
+    };
+
+    void BuildWorld(World &world)
+    {
+        Random random(1);
+        for(UInt32 i = 0; i < kMods; i++)
+        {
+            Mod * mod = new Mod();
+            mod->formId = 0x10000 + i;
+            mod->isEquipment = false;
+            for(UInt32 j = 0; j < kKeywordsPerMod; j++)
+            {
+                mod->keywords.push_back(random.Percent(1) ? kLegendaryKeyword : random.Next());
+            }
+            world.mods[mod->formId] = mod;
+        }
+
+        for(UInt32 i = 0; i < kItems; i++)
+        {
+            Form * form = random.Percent(5) ? (Form *)new NotPlayableForm() : (Form *)new PlayableForm();
+            form->formId = 0x1000 + i;
+            form->isEquipment = random.Percent(40);
+
+            InventoryItem item;
+            item.form = form;
+            UInt32 stackCount = 1 + random.Next() % 3;
+            for(UInt32 j = 0; j < stackCount; j++)
+            {
+                Stack stack;
+                stack.count = 1 + random.Next() % 5;
+                stack.flags = random.Percent(5) ? 1 << 5 : 0;
+                UInt32 modCount = form->isEquipment ? 3 + random.Next() % 6 : 0;
+                for(UInt32 k = 0; k < modCount; k++)
+                {
+                    stack.modIds.push_back(0x10000 + random.Next() % kMods);
+                }
+                item.stacks.push_back(stack);
+            }
+            world.inventory.push_back(item);
+        }
+    }
+
+    bool IsPlayable(Form * form)
+    {
+        return dynamic_cast<PlayableForm *>(form) != nullptr;
+    }
+
+    bool HasLegendaryModID(const World &world, const UInt32 * modIds, UInt32 count)
+    {
+        for(UInt32 i = 0; i < count; i++)
+        {
+            auto it = world.mods.find(modIds[i]);
+            Mod * mod = it != world.mods.end() ? dynamic_cast<Mod *>(it->second) : nullptr;
+            if(mod && std::find(mod->keywords.begin(), mod->keywords.end(), kLegendaryKeyword) != mod->keywords.end())
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    DigestItem Classify(const World &world, const ItemSnapshot &snapshot, const std::vector<UInt32> &modIds)
+    {
+        DigestItem item;
+        item.form = snapshot.form;
+        item.count = snapshot.count;
+        item.isDropped = (snapshot.stackFlags & 1 << 5) != 0;
+        item.isLegendary = snapshot.modIdCount > 0 && HasLegendaryModID(world, &modIds[snapshot.firstModId], snapshot.modIdCount);
+        return item;
+    }
+
+    // Copy an item into the snapshot and its mod IDs into the buffer
+    ItemSnapshot Copy(const InventoryItem &item, std::vector<UInt32> &modIds)
+    {
+        ItemSnapshot snapshot;
+        snapshot.form = item.form;
+        snapshot.count = 0;
+        snapshot.stackFlags = 0;
+        snapshot.firstModId = (UInt32)modIds.size();
+        for(const Stack &stack : item.stacks)
+        {
+            snapshot.count += stack.count;
+            snapshot.stackFlags |= stack.flags;
+            modIds.insert(modIds.end(), stack.modIds.begin(), stack.modIds.end());
+        }
+        snapshot.modIdCount = (UInt32)modIds.size() - snapshot.firstModId;
+        return snapshot;
+    }
+
+    // The digest as the reads used to build it, classifying every item while the lock is held
+    void BuildUnderLock(World &world, std::vector<UInt32> &modIds, std::vector<DigestItem> &digest, double &holdMicroseconds)
+    {
+        digest.clear();
+        world.lock.LockForRead();
+        Stopwatch stopwatch;
+        for(const InventoryItem &item : world.inventory)
+        {
+            modIds.clear();
+            ItemSnapshot snapshot = Copy(item, modIds);
+            if(IsPlayable(snapshot.form))
+            {
+                digest.push_back(Classify(world, snapshot, modIds));
+            }
+        }
+        holdMicroseconds = stopwatch.ElapsedMicroseconds();
+        world.lock.UnlockRead();
+    }
+
+    // The digest as InventoryDigestCache builds it, copying plain values under the lock and classifying them after
+    void BuildAfterRelease(World &world, std::vector<ItemSnapshot> &snapshots, std::vector<UInt32> &modIds, std::vector<DigestItem> &digest,
+                           double &holdMicroseconds)
+    {
+        digest.clear();
+        snapshots.clear();
+        modIds.clear();
+        world.lock.LockForRead();
+        Stopwatch stopwatch;
+        for(const InventoryItem &item : world.inventory)
+        {
+            snapshots.push_back(Copy(item, modIds));
+        }
+        holdMicroseconds = stopwatch.ElapsedMicroseconds();
+        world.lock.UnlockRead();
+
+        for(const ItemSnapshot &snapshot : snapshots)
+        {
+            if(IsPlayable(snapshot.form))
+            {
+                digest.push_back(Classify(world, snapshot, modIds));
+            }
+        }
+    }
+
+    struct Result
+    {
+        UInt64 reads;
+        UInt64 writes;
+        double meanHoldMicroseconds;
+        double maxHoldMicroseconds;
+        std::vector<double> writerWaits;
+    };
+
+    double Percentile(std::vector<double> values, UInt32 percent)
+    {
+        std::sort(values.begin(), values.end());
+        return values.empty() ? 0.0 : values[(std::min)((size_t)(values.size() * percent / 100), values.size() - 1)];
+    }
+
+    Result Run(World &world, bool classifyAfterRelease)
+    {
+        std::atomic<bool> stop(false);
+        std::vector<std::vector<double>> waits(kWriterThreads);
+        std::vector<std::thread> writers;
+        for(UInt32 t = 0; t < kWriterThreads; t++)
+        {
+            writers.push_back(std::thread([&, t]()
+            {
+                Random random(10 + t);
+                while(!stop)
+                {
+                    // A companion or a vendor moves an item: the count of a stack changes
+                    Stopwatch stopwatch;
+                    world.lock.LockForWrite();
+                    waits[t].push_back(stopwatch.ElapsedMicroseconds());
+                    Stack &stack = world.inventory[random.Next() % kItems].stacks[0];
+                    stack.count = 1 + random.Next() % 5;
+                    world.lock.UnlockWrite();
+
+                    std::this_thread::sleep_for(std::chrono::microseconds(200));
+                }
+            }));
+        }
+
+        Result result;
+        result.reads = 0;
+        result.maxHoldMicroseconds = 0.0;
+        double totalHoldMicroseconds = 0.0;
+        std::vector<ItemSnapshot> snapshots;
+        std::vector<UInt32> modIds;
+        std::vector<DigestItem> digest;
+        Stopwatch duration;
+        while(duration.ElapsedMicroseconds() < kDurationMilliseconds * 1000.0)
+        {
+            double holdMicroseconds;
+            if(classifyAfterRelease)
+            {
+                BuildAfterRelease(world, snapshots, modIds, digest, holdMicroseconds);
+            }
+            else
+            {
+                BuildUnderLock(world, modIds, digest, holdMicroseconds);
+            }
+            totalHoldMicroseconds += holdMicroseconds;
+            result.maxHoldMicroseconds = (std::max)(result.maxHoldMicroseconds, holdMicroseconds);
+            result.reads++;
+
+            // The scans read the next inventory after the rest of their work, so the writers get a chance in between
+            std::this_thread::sleep_for(std::chrono::microseconds(50));
+        }
+
+        stop = true;
+        for(std::thread &writer : writers)
+        {
+            writer.join();
+        }
+
+        result.meanHoldMicroseconds = totalHoldMicroseconds / (std::max)(result.reads, (UInt64)1);
+        result.writes = 0;
+        for(std::vector<double> &writerWaits : waits)
+        {
+            result.writes += writerWaits.size();
+            result.writerWaits.insert(result.writerWaits.end(), writerWaits.begin(), writerWaits.end());
+        }
+        return result;
+    }
+
+    void Print(const char * name, const Result &result)
+    {
+        std::printf("%-18s %10llu %10llu %12.1f %12.1f %12.1f %12.1f\n", name, (unsigned long long)result.reads, (unsigned long long)result.writes,
+                    result.meanHoldMicroseconds, result.maxHoldMicroseconds, Percentile(result.writerWaits, 99), Percentile(result.writerWaits, 100));
+    }
+}
+
+int main()
+{
+    World world;
+    BuildWorld(world);
+
+    // Both builds give the same digest of the same inventory
+    std::vector<ItemSnapshot> snapshots;
+    std::vector<UInt32> modIds;
+    std::vector<DigestItem> underLock, afterRelease;
+    double holdMicroseconds;
+    BuildUnderLock(world, modIds, underLock, holdMicroseconds);
+    BuildAfterRelease(world, snapshots, modIds, afterRelease, holdMicroseconds);
+    CHECK(!underLock.empty());
+    CHECK(underLock == afterRelease);
+
+    std::printf("%u items, %u writer threads, %u ms per run\n", kItems, kWriterThreads, kDurationMilliseconds);
+    std::printf("%-18s %10s %10s %12s %12s %12s %12s\n", "classification", "reads", "writes", "us held/read", "max held us", "p99 wait us", "max wait us");
+    Result before = Run(world, false);
+    Result after = Run(world, true);
+    Print("under the lock", before);
+    Print("after release", after);
+
+    // Only copying is left under the lock, which is a fraction of the classification
+    CHECK(after.meanHoldMicroseconds < before.meanHoldMicroseconds);
+
+    std::printf("InventoryLockTest: OK\n");
+    return 0;
+}
@@ -0,0 +1,85 @@
+#include <algorithm>
+#include <vector>
+
+#include "LootPlanner.h"
+#include "LootWorld.h"
+#include "Scratch.h"
+#include "TestSupport.h"
+
+// The cost of one plan over synthetic worlds of growing size, capped at the actions of a looting tick and uncapped.
+// Every plan is checked against the brute force plan, and the planner must not allocate once its buffers are warmed up
+namespace
+{
+    const UInt32 kPlans = 200;
+    const UInt32 kTickActions = 100;
+
+    double Percentile(std::vector<double> latencies, UInt32 percent)
+    {
+        std::sort(latencies.begin(), latencies.end());
+        return latencies[(std::min)((size_t)(latencies.size() * percent / 100), latencies.size() - 1)];
+    }
+
+    // Time the plans and return the latencies in microseconds
+    std::vector<double> Run(LootWorld::World &world, const FormTypeMask &itemTypes, UInt32 options, UInt32 maxActions, size_t &actionCount)
+    {
+        LootPlanner::Workspace workspace;
+        Scratch::Vector<LootPlanner::Source> sources;
+        Scratch::Vector<LootPlanner::Action> actions;
+        std::vector<double> latencies;
+        UInt32 allocations = 0;
+        for(UInt32 plan = 0; plan < kPlans; plan++)
+        {
+            // The sources are found by the scan in no particular order
+            sources.Reset();
+            for(const LootWorld::Node &node : world.nodes)
+            {
+                sources.push_back(node.source);
+            }
+            actions.Reset();
+
+            // A buffer counts its growth when it is reset by the next plan
+            if(plan == 2)
+            {
+                allocations = Scratch::allocations;
+            }
+
+            Stopwatch stopwatch;
+            LootPlanner::Plan(world, world.player, sources, itemTypes, options, maxActions, workspace, actions);
+            latencies.push_back(stopwatch.ElapsedMicroseconds());
+        }
+
+        CHECK(Scratch::allocations == allocations);
+        CHECK(actions == LootWorld::BruteForcePlan(world, itemTypes, options, maxActions));
+        actionCount = actions.size();
+        return latencies;
+    }
+}
+
+int main()
+{
+    FormTypeMask itemTypes;
+    for(UInt8 i = 0; i < LootWorld::kItemTypes; i++)
+    {
+        itemTypes.Set(LootWorld::kFirstItemType + i);
+    }
+    UInt32 options = LootPlanner::kLootPlan_Containers | LootPlanner::kLootPlan_Corpses | LootPlanner::kLootPlan_ApplyExclusions |
+                     LootPlanner::kLootPlan_ScrapEquipment | LootPlanner::kLootPlan_ScrapJunk;
+
+    std::printf("One plan, every option but the workshop and legendary ones, %u plans per row\n", kPlans);
+    std::printf("%10s %12s %12s %12s %12s %12s\n", "sources", "tick actions", "tick p50 us", "tick p99 us", "all actions", "all p50 us");
+
+    UInt32 sizes[] = { 100, 1000, 10000 };
+    for(UInt32 size : sizes)
+    {
+        Random random(size);
+        LootWorld::World world;
+        world.Build(random, size, 30);
+
+        size_t tickActions, allActions;
+        std::vector<double> tick = Run(world, itemTypes, options, kTickActions, tickActions);
+        std::vector<double> all = Run(world, itemTypes, options, 0xFFFFFFFF, allActions);
+        std::printf("%10u %12u %12.1f %12.1f %12u %12.1f\n", size, (UInt32)tickActions, Percentile(tick, 50), Percentile(tick, 99),
+                    (UInt32)allActions, Percentile(all, 50));
+    }
+    return 0;
+}
@@ -0,0 +1,95 @@
+#include <vector>
+
+#include "LootPlanner.h"
+#include "LootWorld.h"
+#include "TestSupport.h"
+
+// The planner against the brute force plan of synthetic worlds, for every combination of options and several plan sizes
+namespace
+{
+    const UInt32 kOptions = 1 << 7;
+
+    void TestAgainstBruteForce()
+    {
+        UInt32 maxActionCounts[] = { 1, 2, 7, 40, 0xFFFFFFFF };
+        for(UInt32 seed = 1; seed <= 20; seed++)
+        {
+            Random random(seed);
+            LootWorld::World world;
+            world.Build(random, 1 + random.Next() % 80, 12);
+
+            FormTypeMask itemTypes;
+            for(UInt8 i = 0; i < LootWorld::kItemTypes; i++)
+            {
+                if(random.Percent(70))
+                {
+                    itemTypes.Set(LootWorld::kFirstItemType + i);
+                }
+            }
+
+            LootPlanner::Workspace workspace;
+            for(UInt32 options = 0; options < kOptions; options++)
+            {
+                for(UInt32 maxActions : maxActionCounts)
+                {
+                    std::vector<LootPlanner::Source> sources = world.GetSources();
+                    std::vector<LootPlanner::Action> actions;
+                    LootPlanner::Plan(world, world.player, sources, itemTypes, options, maxActions, workspace, actions);
+                    CHECK(actions == LootWorld::BruteForcePlan(world, itemTypes, options, maxActions));
+                }
+            }
+        }
+    }
+
+    // The world is only asked about what the plan needs
+    void TestLaziness()
+    {
+        Random random(100);
+        LootWorld::World world;
+        world.Build(random, 500, 12);
+
+        FormTypeMask itemTypes;
+        for(UInt8 i = 0; i < LootWorld::kItemTypes; i++)
+        {
+            itemTypes.Set(LootWorld::kFirstItemType + i);
+        }
+
+        LootPlanner::Workspace workspace;
+        std::vector<LootPlanner::Source> sources = world.GetSources();
+        std::vector<LootPlanner::Action> actions;
+        LootPlanner::Plan(world, world.player, sources, itemTypes, LootPlanner::kLootPlan_Containers, 0xFFFFFFFF, workspace, actions);
+        CHECK(world.deadChecks == 0);
+        CHECK(world.scraps == 0);
+
+        // A full plan stops reading the sources after it
+        UInt32 fullReads = world.itemReads;
+        world.itemReads = 0;
+        sources = world.GetSources();
+        actions.clear();
+        LootPlanner::Plan(world, world.player, sources, itemTypes, LootPlanner::kLootPlan_Containers, 10, workspace, actions);
+        CHECK(actions.size() == 10);
+        CHECK(world.itemReads < fullReads / 4);
+
+        // Only the actors are checked for death, and the player never is
+        UInt32 deadActors = 0;
+        for(const LootWorld::Node &node : world.nodes)
+        {
+            if(node.source.kind == LootPlanner::kSource_Actor && &node != world.player)
+            {
+                deadActors++;
+            }
+        }
+        sources = world.GetSources();
+        actions.clear();
+        LootPlanner::Plan(world, world.player, sources, itemTypes, LootPlanner::kLootPlan_Corpses, 0xFFFFFFFF, workspace, actions);
+        CHECK(world.deadChecks == deadActors);
+    }
+}
+
+int main()
+{
+    TestAgainstBruteForce();
+    TestLaziness();
+    std::printf("LootPlannerTest: OK\n");
+    return 0;
+}
@@ -0,0 +1,278 @@
+#pragma once
+
+#include <algorithm>
+#include <vector>
+
+#include "LootPlanner.h"
+#include "TestSupport.h"
+
+namespace LootPlanner
+{
+    inline bool operator==(const Action &a, const Action &b)
+    {
+        return a.source == b.source && a.item == b.item && a.count == b.count && a.flags == b.flags;
+    }
+}
+
+// A synthetic world for LootPlanner, and a brute force plan of it written from the rules rather than from the planner.
+// Item and component forms are addresses in a table of forms, sources are addresses of their nodes
+namespace LootWorld
+{
+    const UInt8 kFirstItemType = 40;
+    const UInt8 kItemTypes = 8;
+    const UInt32 kForms = 300;
+    const UInt32 kComponentForms = 30;
+
+    struct Node
+    {
+        LootPlanner::Source source;
+        bool isDead;
+        bool isLinkedToWorkshop;
+        std::vector<LootPlanner::Item> items;   // The item of an item reference, or the inventory of a container or actor
+    };
+
+    class World
+    {
+    public:
+        World() : forms(kForms), componentForms(kComponentForms), recipes(kForms), player(nullptr), deadChecks(0), itemReads(0), scraps(0)
+        {
+        }
+
+        // Fill the world with the sources, one of which is the player
+        void Build(Random &random, UInt32 sourceCount, UInt32 maxItems)
+        {
+            for(UInt32 i = 0; i < kForms; i++)
+            {
+                // Some forms scrap into nothing, some components are needed zero times
+                UInt32 componentCount = random.Next() % 4;
+                for(UInt32 j = 0; j < componentCount; j++)
+                {
+                    LootPlanner::Component component;
+                    component.form = &componentForms[random.Next() % kComponentForms];
+                    component.count = random.Next() % 5;
+                    recipes[i].push_back(component);
+                }
+            }
+
+            nodes.resize(sourceCount);
+            for(UInt32 i = 0; i < sourceCount; i++)
+            {
+                Node &node = nodes[i];
+                node.source.ref = &node;
+                node.source.kind = (UInt8)(random.Next() % 3);
+                node.source.distance = random.Range(0.0f, 5000.0f);
+                node.isDead = random.Percent(60);
+                node.isLinkedToWorkshop = random.Percent(15);
+
+                UInt32 itemCount = node.source.kind == LootPlanner::kSource_Item ? 1 : random.Next() % (maxItems + 1);
+                for(UInt32 j = 0; j < itemCount; j++)
+                {
+                    node.items.push_back(MakeItem(random));
+                }
+            }
+
+            player = &nodes[random.Next() % sourceCount];
+            player->source.kind = LootPlanner::kSource_Actor;
+            player->isDead = true;
+        }
+
+        bool IsDead(const LootPlanner::Source &source)
+        {
+            deadChecks++;
+            return GetNode(source).isDead;
+        }
+
+        bool IsLinkedToWorkshop(const LootPlanner::Source &source)
+        {
+            return GetNode(source).isLinkedToWorkshop;
+        }
+
+        void GetItem(const LootPlanner::Source &source, LootPlanner::Item &item)
+        {
+            itemReads++;
+            item = GetNode(source).items[0];
+        }
+
+        void GetItems(const LootPlanner::Source &source, std::vector<LootPlanner::Item> &items)
+        {
+            itemReads++;
+            const Node &node = GetNode(source);
+            items.insert(items.end(), node.items.begin(), node.items.end());
+        }
+
+        void Scrap(const LootPlanner::Source &, std::vector<LootPlanner::Item> &items, std::vector<LootPlanner::Component> &components)
+        {
+            scraps++;
+            for(LootPlanner::Item &item : items)
+            {
+                if((item.flags & LootPlanner::kItemFlag_Scrap) == 0)
+                {
+                    continue;
+                }
+
+                item.firstComponent = (UInt32)components.size();
+                AppendComponents(item, components);
+                item.componentCount = (UInt32)components.size() - item.firstComponent;
+            }
+        }
+
+        // The components of scrapping every object of the item, without the ones needed zero times
+        void AppendComponents(const LootPlanner::Item &item, std::vector<LootPlanner::Component> &components) const
+        {
+            for(const LootPlanner::Component &element : recipes[(int *)item.form - &forms[0]])
+            {
+                if(element.count > 0)
+                {
+                    LootPlanner::Component component;
+                    component.form = element.form;
+                    component.count = element.count * item.count;
+                    components.push_back(component);
+                }
+            }
+        }
+
+        std::vector<LootPlanner::Source> GetSources() const
+        {
+            std::vector<LootPlanner::Source> sources;
+            for(const Node &node : nodes)
+            {
+                sources.push_back(node.source);
+            }
+            return sources;
+        }
+
+        std::vector<int> forms;
+        std::vector<int> componentForms;
+        std::vector<std::vector<LootPlanner::Component>> recipes;
+        std::vector<Node> nodes;
+        Node * player;
+
+        // Calls of the planner into the world
+        UInt32 deadChecks;
+        UInt32 itemReads;
+        UInt32 scraps;
+
+    private:
+        static const Node & GetNode(const LootPlanner::Source &source)
+        {
+            return *(const Node *)source.ref;
+        }
+
+        LootPlanner::Item MakeItem(Random &random)
+        {
+            LootPlanner::Item item;
+            UInt32 formIndex = random.Next() % kForms;
+            item.form = &forms[formIndex];
+            item.formType = (UInt8)(kFirstItemType + formIndex % kItemTypes);
+            item.count = random.Percent(5) ? 0 : 1 + random.Next() % 10;
+            item.flags = 0;
+            if(formIndex % kItemTypes < 2)
+            {
+                item.flags |= LootPlanner::kItemFlag_Equipment;
+                if(random.Percent(10))
+                {
+                    item.flags |= LootPlanner::kItemFlag_Legendary;
+                }
+                if(random.Percent(5))
+                {
+                    item.flags |= LootPlanner::kItemFlag_DroppedWeapon;
+                }
+            }
+            else if(formIndex % kItemTypes == 2)
+            {
+                item.flags |= LootPlanner::kItemFlag_Junk;
+            }
+            if(random.Percent(10))
+            {
+                item.flags |= LootPlanner::kItemFlag_Excluded;
+            }
+            item.firstComponent = 0;
+            item.componentCount = 0;
+            return item;
+        }
+    };
+
+    // Plan every source that is lootable and every item of it that is wanted, then keep the whole groups that fit
+    inline std::vector<LootPlanner::Action> BruteForcePlan(const World &world, const FormTypeMask &itemTypes, UInt32 options, UInt32 maxActions)
+    {
+        std::vector<const Node *> order;
+        for(const Node &node : world.nodes)
+        {
+            order.push_back(&node);
+        }
+        std::stable_sort(order.begin(), order.end(), [](const Node * a, const Node * b)
+        {
+            return a->source.distance < b->source.distance;
+        });
+
+        std::vector<std::vector<LootPlanner::Action>> groups;
+        for(const Node * node : order)
+        {
+            UInt8 kind = node->source.kind;
+            if(kind == LootPlanner::kSource_Container && (options & LootPlanner::kLootPlan_Containers) == 0)
+            {
+                continue;
+            }
+            if(kind == LootPlanner::kSource_Actor && ((options & LootPlanner::kLootPlan_Corpses) == 0 || !node->isDead))
+            {
+                continue;
+            }
+            if(kind != LootPlanner::kSource_Item && (node == world.player ||
+               ((options & LootPlanner::kLootPlan_IncludeWorkshop) == 0 && node->isLinkedToWorkshop)))
+            {
+                continue;
+            }
+
+            UInt32 sourceFlags = kind == LootPlanner::kSource_Item ? (UInt32)LootPlanner::kLootAction_PickUp :
+                                 kind == LootPlanner::kSource_Actor ? (UInt32)LootPlanner::kLootAction_FromActor : 0;
+            for(const LootPlanner::Item &item : node->items)
+            {
+                bool isLegendary = (item.flags & LootPlanner::kItemFlag_Legendary) != 0;
+                if(!itemTypes.Test(item.formType) || item.count <= 0 || (item.flags & LootPlanner::kItemFlag_DroppedWeapon) != 0 ||
+                   (isLegendary && (options & LootPlanner::kLootPlan_SkipLegendary) != 0) ||
+                   ((item.flags & LootPlanner::kItemFlag_Excluded) != 0 && (options & LootPlanner::kLootPlan_ApplyExclusions) != 0))
+                {
+                    continue;
+                }
+
+                std::vector<LootPlanner::Component> components;
+                bool isScrapped = !isLegendary &&
+                                  (((item.flags & LootPlanner::kItemFlag_Equipment) != 0 && (options & LootPlanner::kLootPlan_ScrapEquipment) != 0) ||
+                                   ((item.flags & LootPlanner::kItemFlag_Junk) != 0 && (options & LootPlanner::kLootPlan_ScrapJunk) != 0));
+                if(isScrapped)
+                {
+                    world.AppendComponents(item, components);
+                    isScrapped = !components.empty();
+                }
+
+                std::vector<LootPlanner::Action> group;
+                LootPlanner::Action action;
+                action.source = node->source.ref;
+                action.item = item.form;
+                action.count = (UInt32)item.count;
+                action.flags = sourceFlags | (isLegendary ? (UInt32)LootPlanner::kLootAction_Legendary : 0) |
+                               (isScrapped ? (UInt32)LootPlanner::kLootAction_Scrap : 0);
+                group.push_back(action);
+                for(const LootPlanner::Component &component : components)
+                {
+                    action.item = component.form;
+                    action.count = component.count;
+                    action.flags = sourceFlags | LootPlanner::kLootAction_Component;
+                    group.push_back(action);
+                }
+                groups.push_back(group);
+            }
+        }
+
+        std::vector<LootPlanner::Action> actions;
+        for(const std::vector<LootPlanner::Action> &group : groups)
+        {
+            if(actions.size() + group.size() > maxActions)
+            {
+                break;
+            }
+            actions.insert(actions.end(), group.begin(), group.end());
+        }
+        return actions;
+    }
+}
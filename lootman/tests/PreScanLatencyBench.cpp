@@ -0,0 +1,181 @@
+#include <algorithm>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "FormTypeMask.h"
+#include "PreScanWorker.h"
+#include "SpatialIndex.h"
+#include "TestSupport.h"
+
+using namespace SpatialIndex;
+
+// The player walks across a synthetic world and scans around itself at a fixed rate, once with the full query of the index
+// and once answered from the lists of the pre-scan worker. Every scan is checked against a brute force search of the world
+namespace
+{
+    const UInt32 kSpaceId = 0x3C;
+    const UInt32 kReferences = 200000;
+    const float kWorldSize = 100000.0f;
+    const UInt32 kScans = 300;
+    const UInt32 kScanInterval = 10;        // Milliseconds between two scans
+    const float kSpeed = 600.0f;            // Units per second, faster than a running player
+    const UInt32 kRange = 3000;
+    const UInt32 kMaxAge = 1000;
+    const UInt32 kMaxDisplacement = 1000;
+
+    Grid grid;
+    std::unordered_map<UInt32, Entry> world;
+    FormTypeMask scannedFormTypes;
+
+    std::shared_ptr<const Snapshot> GetSnapshot()
+    {
+        return grid.GetSnapshot();
+    }
+
+    void BuildWorld()
+    {
+        Random random(1);
+        for(UInt32 i = 0; i < kReferences; i++)
+        {
+            Entry entry;
+            entry.formId = i + 1;
+            entry.cellId = 1;
+            entry.cell = nullptr;
+            entry.formType = (UInt8)(40 + random.Next() % 8);
+            entry.flags = random.Percent(1) ? (UInt32)kEntryFlag_Movable : 0;
+            if(random.Percent(5))
+            {
+                entry.flags |= kEntryFlag_NotPlayable;
+            }
+            entry.x = random.Range(-kWorldSize / 2, kWorldSize / 2);
+            entry.y = random.Range(-kWorldSize / 2, kWorldSize / 2);
+            entry.z = random.Range(-500.0f, 500.0f);
+            entry.ref = nullptr;
+            grid.Insert(kSpaceId, entry);
+            world[entry.formId] = entry;
+        }
+        grid.Publish(1);
+
+        scannedFormTypes.Set(40);
+        scannedFormTypes.Set(41);
+        scannedFormTypes.Set(42);
+    }
+
+    // Stand-in for the checks of the scans, which read the live object whichever way it was found
+    bool IsFound(UInt32 formId, float x, float y, float z)
+    {
+        const Entry &entry = world.find(formId)->second;
+        float dx = entry.x - x;
+        float dy = entry.y - y;
+        float dz = entry.z - z;
+        return scannedFormTypes.Test(entry.formType) && (entry.flags & kEntryFlag_NotPlayable) == 0 &&
+               (dx * dx) + (dy * dy) + (dz * dz) <= (float)kRange * kRange;
+    }
+
+    struct Result
+    {
+        std::vector<double> latencies;
+        UInt32 answeredByWorker;
+    };
+
+    Result Run(bool useWorker)
+    {
+        PreScanWorker::Configure(useWorker, kRange, kMaxAge, kMaxDisplacement);
+
+        Result result;
+        result.answeredByWorker = 0;
+        std::vector<UInt32> hits;
+        std::vector<UInt32> found;
+        float x = -kWorldSize / 4;
+        float y = 0.0f;
+        float z = 0.0f;
+        for(UInt32 scan = 0; scan < kScans; scan++)
+        {
+            found.clear();
+            Stopwatch stopwatch;
+            std::shared_ptr<const PreScanWorker::Result> preScan = PreScanWorker::GetResult(kSpaceId, x, y, z, kRange);
+            if(preScan)
+            {
+                for(const PreScanWorker::Reference &reference : preScan->references)
+                {
+                    if(!reference.MayBeWithin(x, y, z, (float)kRange))
+                    {
+                        continue;
+                    }
+
+                    if(IsFound(reference.formId, x, y, z))
+                    {
+                        found.push_back(reference.formId);
+                    }
+                }
+                result.answeredByWorker++;
+            }
+            else
+            {
+                std::shared_ptr<const Snapshot> snapshot = grid.GetSnapshot();
+                scannedFormTypes.ForEach([&](UInt8 formType)
+                {
+                    snapshot->Query(kSpaceId, x, y, z, kRange + kPositionSlack, formType, kEntryFlag_NotPlayable, hits, [&](const Entry &entry)
+                    {
+                        if(IsFound(entry.formId, x, y, z))
+                        {
+                            found.push_back(entry.formId);
+                        }
+                    });
+                });
+            }
+            result.latencies.push_back(stopwatch.ElapsedMicroseconds());
+
+            std::vector<UInt32> expected;
+            for(auto &element : world)
+            {
+                if(IsFound(element.first, x, y, z))
+                {
+                    expected.push_back(element.first);
+                }
+            }
+            std::sort(found.begin(), found.end());
+            std::sort(expected.begin(), expected.end());
+            CHECK(found == expected);
+
+            std::this_thread::sleep_for(std::chrono::milliseconds(kScanInterval));
+            x += kSpeed * kScanInterval / 1000.0f;
+        }
+
+        PreScanWorker::Configure(false, kRange, kMaxAge, kMaxDisplacement);
+        return result;
+    }
+
+    double Percentile(std::vector<double> latencies, UInt32 percent)
+    {
+        std::sort(latencies.begin(), latencies.end());
+        return latencies[(std::min)((size_t)(latencies.size() * percent / 100), latencies.size() - 1)];
+    }
+
+    void Print(const char * name, const Result &result)
+    {
+        std::printf("%-12s %10.1f %10.1f %10.1f %9u/%u\n", name, Percentile(result.latencies, 50), Percentile(result.latencies, 99),
+                    Percentile(result.latencies, 100), result.answeredByWorker, kScans);
+    }
+}
+
+int main()
+{
+    BuildWorld();
+    PreScanWorker::SetSource(GetSnapshot, scannedFormTypes);
+
+    std::printf("%u references, range %u, a scan every %u ms at %.0f units/s\n", kReferences, kRange, kScanInterval, kSpeed);
+    std::printf("%-12s %10s %10s %10s %12s\n", "scan", "p50 us", "p99 us", "max us", "from worker");
+    Result query = Run(false);
+    Result worker = Run(true);
+    Print("index query", query);
+    Print("pre-scan", worker);
+
+    // Most scans find a fresh list once the worker has caught up with the player
+    CHECK(query.answeredByWorker == 0);
+    CHECK(worker.answeredByWorker > kScans / 2);
+
+    PreScanWorker::Shutdown();
+    return 0;
+}
@@ -0,0 +1,83 @@
+#include <unordered_map>
+#include <unordered_set>
+
+#include "Scratch.h"
+#include "TestSupport.h"
+
+// The stamped sets and maps against the standard containers, over many clears and past their initial size
+namespace
+{
+    void TestIDSet()
+    {
+        Random random(1);
+        Scratch::IDSet set;
+        for(UInt32 round = 0; round < 200; round++)
+        {
+            set.Clear();
+            std::unordered_set<UInt32> expected;
+            UInt32 inserts = random.Next() % 4000;
+            for(UInt32 i = 0; i < inserts; i++)
+            {
+                UInt32 formId = random.Next() % 3000;
+                CHECK(set.Insert(formId) == expected.insert(formId).second);
+            }
+        }
+    }
+
+    void TestIDMap()
+    {
+        Random random(2);
+        Scratch::IDMap map;
+        std::vector<int> objects(3000);
+        for(UInt32 round = 0; round < 200; round++)
+        {
+            map.Clear();
+            std::unordered_map<UInt32, void *> expected;
+            UInt32 operations = random.Next() % 4000;
+            for(UInt32 i = 0; i < operations; i++)
+            {
+                UInt32 formId = random.Next() % 3000;
+                void * value = nullptr;
+                bool found = map.Find(formId, value);
+                auto expectedIt = expected.find(formId);
+                CHECK(found == (expectedIt != expected.end()));
+                CHECK(!found || value == expectedIt->second);
+
+                // Null is a value as well, for a cell that is no longer loaded
+                void * newValue = random.Percent(10) ? nullptr : &objects[random.Next() % objects.size()];
+                map.Insert(formId, newValue);
+                expected[formId] = newValue;
+            }
+        }
+    }
+
+    void TestSteadyState()
+    {
+        Scratch::IDMap map;
+        for(UInt32 formId = 0; formId < 5000; formId++)
+        {
+            map.Insert(formId, nullptr);
+        }
+
+        // Once grown, a map filled to the same size again does not allocate
+        UInt32 allocations = Scratch::allocations;
+        for(UInt32 round = 0; round < 10; round++)
+        {
+            map.Clear();
+            for(UInt32 formId = 0; formId < 5000; formId++)
+            {
+                map.Insert(formId + round, nullptr);
+            }
+        }
+        CHECK(Scratch::allocations == allocations);
+    }
+}
+
+int main()
+{
+    TestIDSet();
+    TestIDMap();
+    TestSteadyState();
+    std::printf("ScratchTest: OK\n");
+    return 0;
+}
@@ -0,0 +1,138 @@
+#include <algorithm>
+#include <vector>
+
+#include "xbyak/xbyak_util.h"
+
+#include "SpatialIndex.h"
+#include "TestSupport.h"
+
+using namespace SpatialIndex;
+
+namespace
+{
+    // Time the kernel over the points, repeated until about the same number of points is filtered for every size
+    double TimeKernel(FilterKernel kernel, const std::vector<float> &xs, const std::vector<float> &ys, const std::vector<float> &zs,
+                      const std::vector<UInt32> &flags, std::vector<UInt32> &out, UInt32 &found)
+    {
+        UInt32 count = (UInt32)xs.size();
+        UInt32 repeats = (std::max)(1u, 20000000u / count);
+
+        Stopwatch stopwatch;
+        for(UInt32 i = 0; i < repeats; i++)
+        {
+            found = kernel(&xs[0], &ys[0], &zs[0], &flags[0], count, 0.0f, 0.0f, 0.0f, 20000.0f * 20000.0f, kEntryFlag_NotPlayable, &out[0]);
+        }
+        return stopwatch.ElapsedMicroseconds() * 1000.0 / ((double)repeats * count);
+    }
+
+    void BenchKernels()
+    {
+        Xbyak::util::Cpu cpu;
+        bool hasAVX2 = cpu.has(Xbyak::util::Cpu::tAVX2);
+
+        std::printf("Filter kernels, ns per point\n");
+        std::printf("%10s %10s %10s %10s %10s %10s\n", "points", "scalar", "sse", "avx2", "sse x", "avx2 x");
+
+        UInt32 sizes[] = { 10000, 100000, 1000000 };
+        for(UInt32 count : sizes)
+        {
+            Random random(count);
+            std::vector<float> xs(count), ys(count), zs(count);
+            std::vector<UInt32> flags(count), out(count);
+            for(UInt32 i = 0; i < count; i++)
+            {
+                xs[i] = random.Range(-100000.0f, 100000.0f);
+                ys[i] = random.Range(-100000.0f, 100000.0f);
+                zs[i] = random.Range(-5000.0f, 5000.0f);
+                flags[i] = random.Percent(10) ? kEntryFlag_NotPlayable : 0;
+            }
+
+            UInt32 scalarFound, sseFound, avx2Found = 0;
+            double scalar = TimeKernel(FilterScalar, xs, ys, zs, flags, out, scalarFound);
+            double sse = TimeKernel(FilterSSE, xs, ys, zs, flags, out, sseFound);
+            double avx2 = hasAVX2 ? TimeKernel(FilterAVX2, xs, ys, zs, flags, out, avx2Found) : 0.0;
+            CHECK(sseFound == scalarFound && (!hasAVX2 || avx2Found == scalarFound));
+
+            std::printf("%10u %10.3f %10.3f %10.3f %10.2f %10.2f\n", count, scalar, sse, avx2, scalar / sse, hasAVX2 ? scalar / avx2 : 0.0);
+        }
+    }
+
+    // The baseline walked every loaded reference and checked its distance, the index only visits the squares around the origin
+    void BenchQuery()
+    {
+        std::printf("\nRadius queries, us per query\n");
+        std::printf("%10s %10s %10s %10s\n", "refs", "linear", "index", "speedup");
+
+        UInt32 sizes[] = { 10000, 100000, 1000000 };
+        for(UInt32 count : sizes)
+        {
+            Random random(count + 1);
+            Grid grid;
+            std::vector<Entry> entries;
+            for(UInt32 i = 0; i < count; i++)
+            {
+                Entry entry;
+                entry.formId = i + 1;
+                entry.cellId = 1;
+                entry.cell = nullptr;
+                entry.formType = (UInt8)(40 + random.Next() % 8);
+                entry.flags = 0;
+                entry.x = random.Range(-100000.0f, 100000.0f);
+                entry.y = random.Range(-100000.0f, 100000.0f);
+                entry.z = random.Range(-5000.0f, 5000.0f);
+                entry.ref = nullptr;
+                grid.Insert(1, entry);
+                entries.push_back(entry);
+            }
+            grid.Publish(1);
+            std::shared_ptr<const Snapshot> snapshot = grid.GetSnapshot();
+
+            const UInt32 kQueries = 200;
+            const float kRadius = 6000.0f;
+            std::vector<float> origins;
+            for(UInt32 i = 0; i < kQueries * 2; i++)
+            {
+                origins.push_back(random.Range(-100000.0f, 100000.0f));
+            }
+
+            UInt32 linearFound = 0;
+            Stopwatch linearStopwatch;
+            for(UInt32 q = 0; q < kQueries; q++)
+            {
+                for(const Entry &entry : entries)
+                {
+                    float dx = origins[q * 2] - entry.x;
+                    float dy = origins[q * 2 + 1] - entry.y;
+                    float dz = entry.z;
+                    if(entry.formType == 40 && (dx * dx) + (dy * dy) + (dz * dz) <= kRadius * kRadius)
+                    {
+                        linearFound++;
+                    }
+                }
+            }
+            double linear = linearStopwatch.ElapsedMicroseconds() / kQueries;
+
+            UInt32 indexFound = 0;
+            std::vector<UInt32> hits;
+            Stopwatch indexStopwatch;
+            for(UInt32 q = 0; q < kQueries; q++)
+            {
+                snapshot->Query(1, origins[q * 2], origins[q * 2 + 1], 0.0f, kRadius, 40, 0, hits, [&indexFound](const Entry &)
+                {
+                    indexFound++;
+                });
+            }
+            double index = indexStopwatch.ElapsedMicroseconds() / kQueries;
+            CHECK(indexFound == linearFound);
+
+            std::printf("%10u %10.2f %10.2f %10.1f\n", count, linear, index, linear / index);
+        }
+    }
+}
+
+int main()
+{
+    BenchKernels();
+    BenchQuery();
+    return 0;
+}
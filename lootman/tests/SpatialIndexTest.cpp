@@ -0,0 +1,286 @@
+#include <algorithm>
+#include <unordered_map>
+#include <vector>
+
+#include "xbyak/xbyak_util.h"
+
+#include "SpatialIndex.h"
+#include "TestSupport.h"
+
+using namespace SpatialIndex;
+
+namespace
+{
+    const UInt32 kSpaceId = 0x3C;
+    const UInt32 kOtherSpaceId = 0x1234;
+    const float kWorldSize = 80000.0f;
+
+    // The world as the test knows it, to compute the expected result of a query by brute force
+    typedef std::unordered_map<UInt32, Entry> World;
+
+    Entry MakeEntry(Random &random, UInt32 formId)
+    {
+        Entry entry;
+        entry.formId = formId;
+        entry.cellId = 0x1000 + formId % 64;
+        entry.cell = nullptr;
+        entry.formType = (UInt8)(40 + random.Next() % 3);
+        entry.flags = 0;
+        if(random.Percent(10))
+        {
+            entry.flags |= kEntryFlag_NotPlayable;
+        }
+        if(random.Percent(5))
+        {
+            entry.flags |= kEntryFlag_Excluded;
+        }
+        if(random.Percent(2))
+        {
+            entry.flags |= kEntryFlag_Movable;
+        }
+        entry.x = random.Range(-kWorldSize / 2, kWorldSize / 2);
+        entry.y = random.Range(-kWorldSize / 2, kWorldSize / 2);
+        entry.z = random.Range(-2000.0f, 2000.0f);
+        entry.ref = nullptr;
+        return entry;
+    }
+
+    std::vector<UInt32> Expected(const World &world, float x, float y, float z, float radius, UInt8 formType, UInt32 rejectFlags)
+    {
+        std::vector<UInt32> formIds;
+        for(auto &element : world)
+        {
+            const Entry &entry = element.second;
+            if(entry.formType != formType || (entry.flags & rejectFlags) != 0)
+            {
+                continue;
+            }
+
+            float dx = x - entry.x;
+            float dy = y - entry.y;
+            float dz = z - entry.z;
+            if((entry.flags & kEntryFlag_Movable) != 0 || (dx * dx) + (dy * dy) + (dz * dz) <= radius * radius)
+            {
+                formIds.push_back(entry.formId);
+            }
+        }
+        std::sort(formIds.begin(), formIds.end());
+        return formIds;
+    }
+
+    std::vector<UInt32> Actual(const Snapshot &snapshot, UInt32 spaceId, float x, float y, float z, float radius, UInt8 formType, UInt32 rejectFlags)
+    {
+        std::vector<UInt32> hits;
+        std::vector<UInt32> formIds;
+        snapshot.Query(spaceId, x, y, z, radius, formType, rejectFlags, hits, [&formIds](const Entry &entry)
+        {
+            formIds.push_back(entry.formId);
+        });
+        std::sort(formIds.begin(), formIds.end());
+        return formIds;
+    }
+
+    // Compare random queries of the snapshot with the brute force result over the world
+    void CheckQueries(Random &random, const Snapshot &snapshot, const World &world)
+    {
+        for(UInt32 i = 0; i < 200; i++)
+        {
+            float x = random.Range(-kWorldSize / 2, kWorldSize / 2);
+            float y = random.Range(-kWorldSize / 2, kWorldSize / 2);
+            float z = random.Range(-2000.0f, 2000.0f);
+            float radius = random.Range(100.0f, 12000.0f);
+            UInt8 formType = (UInt8)(40 + random.Next() % 3);
+            UInt32 rejectFlags = random.Percent(50) ? kEntryFlag_NotPlayable : (kEntryFlag_NotPlayable | kEntryFlag_Excluded);
+
+            CHECK(Actual(snapshot, kSpaceId, x, y, z, radius, formType, rejectFlags) == Expected(world, x, y, z, radius, formType, rejectFlags));
+        }
+    }
+
+    // The movable entries visited in slices of a few entries are the same as in one call
+    void CheckMovableSlices(Random &random, const Snapshot &snapshot)
+    {
+        for(UInt8 formType = 40; formType < 43; formType++)
+        {
+            std::vector<UInt32> whole;
+            auto collectWhole = [&whole](const Entry &entry)
+            {
+                whole.push_back(entry.formId);
+            };
+            snapshot.QueryMovable(kSpaceId, formType, kEntryFlag_NotPlayable, collectWhole);
+
+            std::vector<UInt32> sliced;
+            auto collectSliced = [&sliced](const Entry &entry)
+            {
+                sliced.push_back(entry.formId);
+            };
+            UInt32 position = 0;
+            UInt32 slices = 0;
+            bool isDone = false;
+            while(!isDone)
+            {
+                UInt32 budget = 1 + random.Next() % 8;
+                auto isOverBudget = [&budget]() -> bool
+                {
+                    return budget-- == 0;
+                };
+                isDone = snapshot.QueryMovable(kSpaceId, formType, kEntryFlag_NotPlayable, position, isOverBudget, collectSliced);
+                slices++;
+            }
+
+            CHECK(sliced == whole);
+            CHECK(whole.size() < 8 || slices > 1);
+        }
+    }
+
+    void TestKernels()
+    {
+        Random random(7);
+        std::vector<FilterKernel> kernels;
+        kernels.push_back(FilterScalar);
+        kernels.push_back(FilterSSE);
+        Xbyak::util::Cpu cpu;
+        if(cpu.has(Xbyak::util::Cpu::tAVX2))
+        {
+            kernels.push_back(FilterAVX2);
+        }
+
+        // Counts that are not multiples of the SIMD width exercise the scalar remainder
+        for(UInt32 count = 0; count < 70; count++)
+        {
+            std::vector<float> xs, ys, zs;
+            std::vector<UInt32> flags;
+            for(UInt32 i = 0; i < count; i++)
+            {
+                xs.push_back(random.Range(-1000.0f, 1000.0f));
+                ys.push_back(random.Range(-1000.0f, 1000.0f));
+                zs.push_back(random.Range(-1000.0f, 1000.0f));
+                flags.push_back(random.Next() & 7);
+            }
+            xs.push_back(0.0f);
+            ys.push_back(0.0f);
+            zs.push_back(0.0f);
+            flags.push_back(0);
+
+            std::vector<UInt32> expected(count + 1);
+            UInt32 expectedCount = FilterScalar(&xs[0], &ys[0], &zs[0], &flags[0], count, 10.0f, -20.0f, 30.0f, 800.0f * 800.0f, 2, &expected[0]);
+            expected.resize(expectedCount);
+
+            for(FilterKernel kernel : kernels)
+            {
+                std::vector<UInt32> actual(count + 1);
+                actual.resize(kernel(&xs[0], &ys[0], &zs[0], &flags[0], count, 10.0f, -20.0f, 30.0f, 800.0f * 800.0f, 2, &actual[0]));
+                CHECK(actual == expected);
+            }
+        }
+    }
+
+    void TestKeys()
+    {
+        // The bucket of the movable entries never shares a key with a grid square of the same space and form type
+        for(SInt32 gx = -3; gx <= 3; gx++)
+        {
+            for(SInt32 gy = -3; gy <= 3; gy++)
+            {
+                CHECK(MakeKey(kSpaceId, gx, gy, 40) != MakeMovableKey(kSpaceId, 40));
+            }
+        }
+        CHECK(MakeKey(kSpaceId, -1, -1, 40) != MakeKey(kSpaceId, 1, 1, 40));
+        CHECK(MakeKey(kSpaceId, 0, 0, 40) != MakeKey(kOtherSpaceId, 0, 0, 40));
+        CHECK(MakeMovableKey(kSpaceId, 40) != MakeMovableKey(kSpaceId, 41));
+    }
+
+    void TestGrid()
+    {
+        Random random(42);
+        Grid grid;
+        World world;
+
+        UInt32 nextFormId = 1;
+        for(UInt32 i = 0; i < 20000; i++)
+        {
+            Entry entry = MakeEntry(random, nextFormId++);
+            grid.Insert(kSpaceId, entry);
+            world[entry.formId] = entry;
+        }
+
+        // Entries of another space are never found
+        for(UInt32 i = 0; i < 1000; i++)
+        {
+            grid.Insert(kOtherSpaceId, MakeEntry(random, nextFormId++));
+        }
+
+        grid.Publish(1);
+        std::shared_ptr<const Snapshot> first = grid.GetSnapshot();
+        CHECK(first->GetStamp() == 1);
+        CHECK(first->Size() == 21000);
+        CheckQueries(random, *first, world);
+        CheckMovableSlices(random, *first);
+        World firstWorld = world;
+
+        // Move, remove and add entries, including moves across grid squares and to or from the movable bucket
+        std::vector<UInt32> formIds;
+        for(auto &element : world)
+        {
+            formIds.push_back(element.first);
+        }
+        std::sort(formIds.begin(), formIds.end());
+        for(UInt32 formId : formIds)
+        {
+            if(random.Percent(10))
+            {
+                Entry entry = MakeEntry(random, formId);
+                grid.Insert(kSpaceId, entry);
+                world[formId] = entry;
+            }
+            else if(random.Percent(10))
+            {
+                grid.Remove(formId);
+                world.erase(formId);
+            }
+        }
+        for(UInt32 i = 0; i < 2000; i++)
+        {
+            Entry entry = MakeEntry(random, nextFormId++);
+            grid.Insert(kSpaceId, entry);
+            world[entry.formId] = entry;
+        }
+
+        // Nothing is visible to the readers before the publication, and the old snapshot never changes
+        CHECK(grid.GetSnapshot() == first);
+        grid.Publish(2);
+        std::shared_ptr<const Snapshot> second = grid.GetSnapshot();
+        CHECK(second != first);
+        CheckQueries(random, *second, world);
+        CheckQueries(random, *first, firstWorld);
+
+        // Cell IDs follow the entries
+        UInt32 cellId;
+        CHECK(grid.GetCellID(formIds[0], cellId) == (world.find(formIds[0]) != world.end()));
+        CHECK(!grid.GetCellID(0xFFFFFFFF, cellId));
+
+        // Publishing without a change keeps the snapshot
+        grid.Publish(2);
+        CHECK(grid.GetSnapshot() == second);
+
+        grid.Clear();
+        grid.Publish(3);
+        CHECK(grid.GetSnapshot()->Size() == 0);
+        CheckQueries(random, *grid.GetSnapshot(), World());
+    }
+}
+
+int main()
+{
+    TestKernels();
+    TestKeys();
+    TestGrid();
+
+    // Every kernel gives the same grid results
+    FilterKernel selected = Filter;
+    Filter = FilterScalar;
+    TestGrid();
+    Filter = selected;
+
+    std::printf("SpatialIndexTest: OK\n");
+    return 0;
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+#include "common/ITypes.h"
+
+// Minimal support for the standalone tests and benchmarks. A failed check prints where it is and exits with a non-zero code
+#define CHECK(condition) \
+    do \
+    { \
+        if(!(condition)) \
+        { \
+            std::printf("%s(%d): CHECK(%s) failed\n", __FILE__, __LINE__, #condition); \
+            std::exit(1); \
+        } \
+    } while(0)
+
+// A deterministic random number generator (xorshift), so that a failure can be reproduced
+class Random
+{
+public:
+    explicit Random(UInt32 seed) : state(seed ? seed : 1)
+    {
+    }
+
+    UInt32 Next()
+    {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        return state;
+    }
+
+    // A float in [min, max)
+    float Range(float min, float max)
+    {
+        return min + (max - min) * ((Next() & 0xFFFFFF) / 16777216.0f);
+    }
+
+    // True with the probability of the percent
+    bool Percent(UInt32 percent)
+    {
+        return Next() % 100 < percent;
+    }
+
+private:
+    UInt32 state;
+};
+
+class Stopwatch
+{
+public:
+    Stopwatch() : start(std::chrono::steady_clock::now())
+    {
+    }
+
+    double ElapsedMicroseconds() const
+    {
+        return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+    }
+
+private:
+    std::chrono::steady_clock::time_point start;
+};
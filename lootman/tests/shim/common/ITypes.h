@@ -0,0 +1,17 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+
+// Stand-in for common/ITypes.h when the portable core is built for the tests. The real header depends on the Windows headers,
+// and its UInt32 is unsigned long, which is 64 bits wide on Linux and would break the layout the SIMD kernels read
+typedef uint8_t     UInt8;
+typedef uint16_t    UInt16;
+typedef uint32_t    UInt32;
+typedef uint64_t    UInt64;
+typedef int8_t      SInt8;
+typedef int16_t     SInt16;
+typedef int32_t     SInt32;
+typedef int64_t     SInt64;
+typedef float       Float32;
+typedef double      Float64;